@@ -42,14 +42,18 @@ int DhcpClass::request_DHCP_lease()
   int result = 0;
   unsigned long startTime = millis();
 
+  stm32_eth_scheduler();
   while (_dhcp_state != STATE_DHCP_LEASED) {
-    stm32_eth_scheduler();
     _dhcp_state = stm32_get_DHCP_state();
+    if (_dhcp_state == STATE_DHCP_LEASED) {
+      break;
+    }
 
     if (result != 1 && ((millis() - startTime) > _timeout)) {
       reset_DHCP_lease();
       break;
     }
+    stm32_eth_wait_event(_timeout + 1 - (millis() - startTime));
   }
 
   if (_dhcp_state == STATE_DHCP_LEASED) {
@@ -9,6 +9,132 @@ extern "C" {
 #include "EthernetServer.h"
 #include "Dns.h"
 
+/* LwIP raw API calls, run by stm32_eth_api_call() */
+struct client_connect_args {
+  struct tcp_struct *tcp;
+  ip_addr_t ipaddr;
+  uint16_t port;
+  uint32_t timeout;
+  void (*callback)(void *arg, uint8_t connected);
+  void *callback_arg;
+};
+
+struct client_write_args {
+  struct tcp_struct *tcp;
+  const uint8_t *buf;
+  size_t size;
+  size_t sent;
+  uint8_t apiflags;
+};
+
+struct client_sndbuf_args {
+  struct tcp_struct *tcp;
+  int size;
+};
+
+static err_t eth_client_connect(void *arg)
+{
+  struct client_connect_args *args = (struct client_connect_args *)arg;
+  struct tcp_struct *tcp = args->tcp;
+
+  /* Creates a new TCP protocol control block */
+  tcp->pcb = tcp_new();
+
+  if (tcp->pcb == NULL) {
+    return ERR_MEM;
+  }
+
+  tcp_struct_init(tcp, tcp->pcb, TCP_CONNECTING);
+  tcp->on_connect = args->callback;
+  tcp->on_connect_arg = args->callback_arg;
+
+  tcp_arg(tcp->pcb, tcp);
+  /* Report a connection refused or timed out */
+  tcp_err(tcp->pcb, &tcp_err_callback);
+  tcp_connect_timeout_start(tcp, args->timeout);
+  return tcp_connect(tcp->pcb, &args->ipaddr, args->port, &tcp_connected_callback);
+}
+
+static err_t eth_client_write(void *arg)
+{
+  struct client_write_args *args = (struct client_write_args *)arg;
+  struct tcp_pcb *pcb = args->tcp->pcb;
+  size_t max_send_size, bytes_to_send;
+  err_t res;
+
+  /* Connection closed by the remote */
+  if (pcb == NULL) {
+    return ERR_CLSD;
+  }
+
+  max_send_size = tcp_sndbuf(pcb);
+  bytes_to_send = args->size > max_send_size ? max_send_size : args->size;
+
+  if (bytes_to_send > 0) {
+    /* More data may follow: let LwIP append it to the last segment */
+    res = tcp_write(pcb, args->buf, bytes_to_send, args->apiflags | TCP_WRITE_FLAG_MORE);
+
+    if (res == ERR_OK) {
+      args->sent = bytes_to_send;
+      args->tcp->tx_queued += bytes_to_send;
+      if (!(args->apiflags & TCP_WRITE_FLAG_COPY)) {
+        args->tcp->tx_ref_end = args->tcp->tx_queued;
+      }
+    } else if (res != ERR_MEM) {
+      // other error, cannot continue
+      return res;
+    }
+  }
+
+  if (args->sent < args->size) {
+    // Send buffer full: send data right now to free it
+    return tcp_output(pcb);
+  }
+  // Sent on flush(), on next full buffer or after ETH_TCP_WRITE_LINGER ms
+  return tcp_output_deferred(pcb);
+}
+
+static err_t eth_client_sndbuf(void *arg)
+{
+  struct client_sndbuf_args *args = (struct client_sndbuf_args *)arg;
+  struct tcp_pcb *pcb = args->tcp->pcb;
+
+  // tcp_write() also needs a free segment
+  if ((pcb == NULL) || (pcb->snd_queuelen >= TCP_SND_QUEUELEN)) {
+    args->size = 0;
+  } else {
+    args->size = tcp_sndbuf(pcb);
+  }
+  return ERR_OK;
+}
+
+static err_t eth_client_flush(void *arg)
+{
+  struct tcp_struct *tcp = (struct tcp_struct *)arg;
+
+  if (tcp->pcb != NULL) {
+    tcp_output(tcp->pcb);
+  }
+  return ERR_OK;
+}
+
+static err_t eth_client_close(void *arg)
+{
+  struct tcp_struct *tcp = (struct tcp_struct *)arg;
+
+  // close tcp connection if not closed yet
+  if (tcp->state != TCP_CLOSING) {
+    if (tcp->pcb == NULL) {
+      tcp->state = TCP_CLOSING;
+    } else {
+      tcp_connection_close(tcp->pcb, tcp);
+    }
+  }
+  // release the data not read
+  tcp_struct_free_data(tcp);
+  return ERR_OK;
+}
+
 EthernetClient::EthernetClient()
   : _tcp_client(NULL)
 {
@@ -45,43 +171,61 @@ int EthernetClient::connect(const char *host, uint16_t port)
 
 int EthernetClient::connect(IPAddress ip, uint16_t port)
 {
-  if (_tcp_client == NULL) {
-    /* Allocates memory for client */
-    _tcp_client = (struct tcp_struct *)mem_malloc(sizeof(struct tcp_struct));
-
-    if (_tcp_client == NULL) {
-      return 0;
-    }
+  if (!connectAsync(ip, port)) {
+    return 0;
   }
 
-  /* Creates a new TCP protocol control block */
-  _tcp_client->pcb = tcp_new();
+  while (status() == TCP_CONNECTING) {
+    stm32_eth_wait_event(_connectionTimeout - (millis() - _connectStart));
+  }
 
-  if (_tcp_client->pcb == NULL) {
+  if (_tcp_client->state != TCP_CONNECTED) {
+    stop();
     return 0;
   }
+  return 1;
+}
 
-  _tcp_client->data.p = NULL;
-  _tcp_client->data.available = 0;
-  _tcp_client->state = TCP_NONE;
-
-  uint32_t startTime = millis();
-  ip_addr_t ipaddr;
-  tcp_arg(_tcp_client->pcb, _tcp_client);
-  if (ERR_OK != tcp_connect(_tcp_client->pcb, u8_to_ip_addr(rawIPAddress(ip), &ipaddr), port, &tcp_connected_callback)) {
+/* Start a connection and return immediately, closing the previous one.
+status() is TCP_CONNECTING until the connection is established
+(TCP_CONNECTED) or fails (TCP_CLOSING), at most for the connection timeout.
+callback, if not NULL, is then called from the LwIP context with connected
+set to 1 or 0. It is not called if stop() is called before, and must not
+call stop() itself. */
+int EthernetClient::connectAsync(IPAddress ip, uint16_t port,
+                                 void (*callback)(void *arg, uint8_t connected), void *arg)
+{
+  if (_tcp_client != NULL) {
     stop();
+  }
+  /* Allocates memory for client */
+  _tcp_client = (struct tcp_struct *)mem_malloc(sizeof(struct tcp_struct));
+
+  if (_tcp_client == NULL) {
     return 0;
   }
 
-  startTime = millis();
-  while (_tcp_client->state == TCP_NONE) {
-    stm32_eth_scheduler();
-    if ((_tcp_client->state == TCP_CLOSING) || ((millis() - startTime) >= _connectionTimeout)) {
+  struct client_connect_args args;
+  args.tcp = _tcp_client;
+  u8_to_ip_addr(rawIPAddress(ip), &args.ipaddr);
+  args.port = port;
+  args.timeout = _connectionTimeout;
+  args.callback = callback;
+  args.callback_arg = arg;
+  if (ERR_OK != stm32_eth_api_call(eth_client_connect, &args)) {
+    if (_tcp_client->pcb != NULL) {
       stop();
-      return 0;
+    } else {
+      // tcp_new() failed, the structure is not initialized
+      mem_free(_tcp_client);
+      _tcp_client = NULL;
     }
+    return 0;
   }
 
+  _tcp_client->write_blocking = _writeBlocking;
+  _connectStart = millis();
+  stm32_eth_scheduler();
   return 1;
 }
 
@@ -91,6 +235,80 @@ size_t EthernetClient::write(uint8_t b)
 }
 
 size_t EthernetClient::write(const uint8_t *buf, size_t size)
+{
+  return writeFlags(buf, size, TCP_WRITE_FLAG_COPY,
+                    (_tcp_client == NULL) || _tcp_client->write_blocking);
+}
+
+/* Send a buffer without copying it. It must stay unchanged until isSent()
+returns true for the returned token, status() is TCP_CLOSING or stop() is
+called: closing the connection aborts it while this data is not acknowledged.
+If the connection fails during the write, only a part of the buffer may be
+queued: queued, if not NULL, gets the number of bytes queued and the token
+covers them. Returns 0 if nothing was queued. */
+uint32_t EthernetClient::writeRef(const uint8_t *buf, size_t size, size_t *queued)
+{
+  size_t n = writeFlags(buf, size, 0, true);
+
+  if (queued != NULL) {
+    *queued = n;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  return _tcp_client->tx_queued;
+}
+
+/* Returns true when the remote acknowledged all the data written up to the
+writeRef() call that returned token */
+bool EthernetClient::isSent(uint32_t token)
+{
+  if (_tcp_client == NULL) {
+    return false;
+  }
+  stm32_eth_scheduler();
+  return ((int32_t)(_tcp_client->tx_acked - token) >= 0);
+}
+
+/* Without blocking, write() only queues what fits in the send buffer and
+returns the number of bytes queued, possibly 0. The mode is kept with the
+connection, so it applies to all the copies returned by
+EthernetServer::available(), and to the next connect() of this client. */
+void EthernetClient::setWriteBlocking(bool blocking)
+{
+  _writeBlocking = blocking;
+  if (_tcp_client != NULL) {
+    _tcp_client->write_blocking = blocking;
+  }
+}
+
+/* Called from the LwIP context each time the remote acknowledges data, see
+availableForWrite() */
+void EthernetClient::onWritable(void (*callback)(void *arg), void *arg)
+{
+  if (_tcp_client != NULL) {
+    _tcp_client->writable = NULL;
+    _tcp_client->writable_arg = arg;
+    _tcp_client->writable = callback;
+  }
+}
+
+int EthernetClient::availableForWrite()
+{
+  struct client_sndbuf_args args;
+
+  if ((_tcp_client == NULL) ||
+      ((_tcp_client->state != TCP_ACCEPTED) && (_tcp_client->state != TCP_CONNECTED))) {
+    return 0;
+  }
+  // pcb can be freed by LwIP meanwhile when the connection is reset
+  args.tcp = _tcp_client;
+  args.size = 0;
+  stm32_eth_api_call(eth_client_sndbuf, &args);
+  return args.size;
+}
+
+size_t EthernetClient::writeFlags(const uint8_t *buf, size_t size, uint8_t apiflags, bool blocking)
 {
   if ((_tcp_client == NULL) || (_tcp_client->pcb == NULL) ||
       (buf == NULL) || (size == 0)) {
@@ -104,43 +322,41 @@ size_t EthernetClient::write(const uint8_t *buf, size_t size)
     return 0;
   }
 
-  size_t max_send_size, bytes_to_send;
   size_t bytes_sent = 0;
-  size_t bytes_left = size;
-  err_t res;
+  struct client_write_args args;
+  err_t err;
+  args.tcp = _tcp_client;
+  args.apiflags = apiflags;
 
   do {
-    max_send_size = tcp_sndbuf(_tcp_client->pcb);
-    bytes_to_send = bytes_left > max_send_size ? max_send_size : bytes_left;
-
-    if (bytes_to_send > 0) {
-      res = tcp_write(_tcp_client->pcb, &buf[bytes_sent], bytes_to_send,  TCP_WRITE_FLAG_COPY);
-
-      if (res == ERR_OK) {
-        bytes_sent += bytes_to_send;
-        bytes_left = size - bytes_sent;
-      } else if (res != ERR_MEM) {
-        // other error, cannot continue
-        return 0;
-      }
-    }
-
-    //Force to send data right now!
-    if (ERR_OK != tcp_output(_tcp_client->pcb)) {
-      return 0;
+    args.buf = &buf[bytes_sent];
+    args.size = size - bytes_sent;
+    args.sent = 0;
+    err = stm32_eth_api_call(eth_client_write, &args);
+    // the data queued before an error is still sent
+    bytes_sent += args.sent;
+    if (err != ERR_OK) {
+      break;
     }
     stm32_eth_scheduler();
-
+    if (!blocking) {
+      break;
+    }
+    if (args.sent == 0) {
+      // send buffer full, wait for an acknowledgment
+      stm32_eth_wait_event(UINT32_MAX);
+    }
   } while (bytes_sent != size);
 
-  return size;
+  return bytes_sent;
 }
 
 int EthernetClient::available()
 {
   stm32_eth_scheduler();
   if (_tcp_client != NULL) {
-    return _tcp_client->data.available;
+    // the line returned by readLine() is not available anymore
+    return _tcp_client->data.available - _tcp_client->line_lent;
   }
   return 0;
 }
@@ -148,8 +364,9 @@ int EthernetClient::available()
 int EthernetClient::read()
 {
   uint8_t b;
+  releaseLine();
   if ((_tcp_client != NULL) && (_tcp_client->data.p != NULL)) {
-    stm32_get_data(&(_tcp_client->data), &b, 1);
+    stm32_tcp_get_data(_tcp_client, &b, 1);
     return b;
   }
   // No data available
@@ -158,21 +375,215 @@ int EthernetClient::read()
 
 int EthernetClient::read(uint8_t *buf, size_t size)
 {
+  releaseLine();
   if ((_tcp_client != NULL) && (_tcp_client->data.p != NULL)) {
-    return stm32_get_data(&(_tcp_client->data), buf, size);
+    return stm32_tcp_get_data(_tcp_client, buf, size);
   }
   return -1;
 }
 
 int EthernetClient::peek()
 {
-  uint8_t b;
   // Unlike recv, peek doesn't check to see if there's any data available, so we must
   if (!available()) {
     return -1;
   }
-  b = pbuf_get_at(_tcp_client->data.p, _tcp_client->data.p->tot_len - _tcp_client->data.available);
-  return b;
+  return stm32_peek_data(&(_tcp_client->data), _tcp_client->line_lent);
+}
+
+/* Give access to the next contiguous received bytes without copying them.
+They stay valid until commit() is called to consume them. The bytes follow the
+line returned by the last readLine(), which stays valid as well. Returns their
+number, 0 if no data available */
+int EthernetClient::borrow(const uint8_t **buf)
+{
+  *buf = NULL;
+  if ((_tcp_client != NULL) && (_tcp_client->data.p != NULL)) {
+    return stm32_borrow_data(&(_tcp_client->data), _tcp_client->line_lent, buf);
+  }
+  return 0;
+}
+
+/* Consume size bytes after the line returned by the last readLine(), which is
+consumed as well */
+void EthernetClient::commit(size_t size)
+{
+  releaseLine();
+  if ((size > 0) && (_tcp_client != NULL) && (_tcp_client->data.p != NULL)) {
+    stm32_tcp_commit_data(_tcp_client, size);
+  }
+}
+
+/* Wait for more data after start, at most for the stream timeout. Returns
+false on timeout or if the connection is closed */
+bool EthernetClient::waitData(unsigned long start)
+{
+  if ((_tcp_client == NULL) || (_tcp_client->state == TCP_CLOSING) ||
+      ((millis() - start) >= _timeout)) {
+    return false;
+  }
+  stm32_eth_scheduler();
+  stm32_eth_wait_event(_timeout - (millis() - start));
+  return true;
+}
+
+/* Consume the line returned by the last readLine(). The count is kept with
+the connection, so that a copy returned by EthernetServer::available()
+releases the line read through another one. */
+void EthernetClient::releaseLine()
+{
+  uint32_t lent;
+
+  if ((_tcp_client != NULL) && (_tcp_client->line_lent > 0)) {
+    lent = _tcp_client->line_lent;
+    _tcp_client->line_lent = 0;
+    stm32_tcp_commit_data(_tcp_client, lent);
+  }
+}
+
+size_t EthernetClient::readBytes(char *buffer, size_t length)
+{
+  unsigned long start = millis();
+  size_t n = 0;
+  size_t got;
+
+  releaseLine();
+  while (n < length) {
+    got = 0;
+    if ((_tcp_client != NULL) && (_tcp_client->data.p != NULL)) {
+      got = stm32_tcp_get_data(_tcp_client, (uint8_t *)&buffer[n], length - n);
+    }
+    if (got > 0) {
+      n += got;
+      start = millis();
+    } else if (!waitData(start)) {
+      break;
+    }
+  }
+  return n;
+}
+
+/* Same as Stream::readBytesUntil(), the terminator is searched with memchr()
+in the received data and the bytes before it are copied at once */
+size_t EthernetClient::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+  unsigned long start = millis();
+  size_t n = 0;
+  int32_t pos;
+
+  releaseLine();
+  while ((n < length) && (_tcp_client != NULL)) {
+    pos = stm32_find_data(&(_tcp_client->data), terminator, length - n);
+    if (pos >= 0) {
+      if (pos > 0) {
+        n += stm32_tcp_get_data(_tcp_client, (uint8_t *)&buffer[n], pos);
+      }
+      // the terminator is discarded
+      commit(1);
+      break;
+    }
+    if (_tcp_client->data.p != NULL) {
+      // no terminator in the data received so far
+      n += stm32_tcp_get_data(_tcp_client, (uint8_t *)&buffer[n], length - n);
+      start = millis();
+    } else if (!waitData(start)) {
+      break;
+    }
+  }
+  return n;
+}
+
+/* Same as Stream::find(), the first byte of target is searched with memchr()
+in the received data, the data before it is dropped at once */
+bool EthernetClient::find(char *target, size_t length)
+{
+  unsigned long start = millis();
+  int32_t pos;
+
+  if (length == 0) {
+    return true;
+  }
+  releaseLine();
+  while (_tcp_client != NULL) {
+    pos = stm32_find_data(&(_tcp_client->data), target[0], UINT32_MAX);
+    if (pos < 0) {
+      if (_tcp_client->data.p != NULL) {
+        commit(_tcp_client->data.available);
+        start = millis();
+      } else if (!waitData(start)) {
+        return false;
+      }
+      continue;
+    }
+    if (pos > 0) {
+      commit(pos);
+      start = millis();
+    }
+    switch (stm32_match_data(&(_tcp_client->data), (const uint8_t *)target, length)) {
+      case 1:
+        commit(length);
+        return true;
+      case 0:
+        commit(1);
+        break;
+      default:
+        // partial match, wait for the rest
+        if (!waitData(start)) {
+          return false;
+        }
+        break;
+    }
+  }
+  return false;
+}
+
+/* Read a line ending with '\n', removed with a trailing '\r'. When the line is
+contiguous in the received data, *line points to it without copy until the
+next read*(), readLine(), find(), commit() or stop() on this connection,
+otherwise it is copied in buffer and *line points to buffer, truncated to
+length. available(), peek() and borrow() do not release it. The line is not null-terminated. Returns its
+length, -1 if no full line is received within the stream timeout. */
+int EthernetClient::readLine(const char **line, char *buffer, size_t length)
+{
+  unsigned long start = millis();
+  const uint8_t *span;
+  const uint8_t *eol;
+  int32_t pos;
+  int len;
+
+  *line = NULL;
+  releaseLine();
+  if (_tcp_client == NULL) {
+    return -1;
+  }
+
+  len = borrow(&span);
+  eol = (len > 0) ? (const uint8_t *)memchr(span, '\n', len) : NULL;
+  if (eol != NULL) {
+    len = eol - span;
+    _tcp_client->line_lent = len + 1;
+    *line = (const char *)span;
+  } else {
+    while ((pos = stm32_find_data(&(_tcp_client->data), '\n', length)) < 0) {
+      if (_tcp_client->data.available >= length) {
+        // line longer than buffer
+        break;
+      }
+      if (!waitData(start)) {
+        return -1;
+      }
+    }
+    len = stm32_tcp_get_data(_tcp_client, (uint8_t *)buffer, (pos < 0) ? length : pos);
+    if (pos >= 0) {
+      commit(1);
+    }
+    *line = buffer;
+  }
+
+  if ((len > 0) && ((*line)[len - 1] == '\r')) {
+    len--;
+  }
+  return len;
 }
 
 void EthernetClient::flush()
@@ -180,21 +591,14 @@ void EthernetClient::flush()
   if ((_tcp_client == NULL) || (_tcp_client->pcb == NULL)) {
     return;
   }
-  tcp_output(_tcp_client->pcb);
+  stm32_eth_api_call(eth_client_flush, _tcp_client);
   stm32_eth_scheduler();
 }
 
 void EthernetClient::stop()
 {
   if (_tcp_client != NULL) {
-    // close tcp connection if not closed yet
-    if (status() != TCP_CLOSING) {
-      if (_tcp_client->pcb == NULL) {
-        _tcp_client->state = TCP_CLOSING;
-      } else {
-        tcp_connection_close(_tcp_client->pcb, _tcp_client);
-      }
-    }
+    stm32_eth_api_call(eth_client_close, _tcp_client);
     mem_free(_tcp_client);
     _tcp_client = NULL;
   }
@@ -212,6 +616,7 @@ uint8_t EthernetClient::status()
   if (_tcp_client == NULL) {
     return TCP_NONE;
   }
+  // the connection timeout is applied in the LwIP context
   return _tcp_client->state;
 }
 
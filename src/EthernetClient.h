@@ -16,12 +16,49 @@ class EthernetClient : public Client {
     uint8_t status();
     virtual int connect(IPAddress ip, uint16_t port);
     virtual int connect(const char *host, uint16_t port);
+    int connectAsync(IPAddress ip, uint16_t port,
+                     void (*callback)(void *arg, uint8_t connected) = NULL, void *arg = NULL);
     virtual size_t write(uint8_t);
     virtual size_t write(const uint8_t *buf, size_t size);
+    uint32_t writeRef(const uint8_t *buf, size_t size, size_t *queued = NULL);
+    bool isSent(uint32_t token);
+    virtual int availableForWrite();
+    void setWriteBlocking(bool blocking);
+    void onWritable(void (*callback)(void *arg), void *arg);
     virtual int available();
     virtual int read();
     virtual int read(uint8_t *buf, size_t size);
     virtual int peek();
+    int borrow(const uint8_t **buf);
+    void commit(size_t size);
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length)
+    {
+      return readBytes((char *)buffer, length);
+    };
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+    size_t readBytesUntil(char terminator, uint8_t *buffer, size_t length)
+    {
+      return readBytesUntil(terminator, (char *)buffer, length);
+    };
+    bool find(char *target)
+    {
+      return find(target, strlen(target));
+    };
+    bool find(uint8_t *target)
+    {
+      return find((char *)target);
+    };
+    bool find(char *target, size_t length);
+    bool find(uint8_t *target, size_t length)
+    {
+      return find((char *)target, length);
+    };
+    bool find(char target)
+    {
+      return find(&target, 1);
+    };
+    int readLine(const char **line, char *buffer, size_t length);
     virtual void flush();
     virtual void stop();
     virtual uint8_t connected();
@@ -64,6 +101,13 @@ class EthernetClient : public Client {
   private:
     struct tcp_struct *_tcp_client;
     uint16_t _connectionTimeout = 10000;
+    uint32_t _connectStart = 0;
+    bool _writeBlocking = true;
+
+    bool waitData(unsigned long start);
+    void releaseLine();
+
+    size_t writeFlags(const uint8_t *buf, size_t size, uint8_t apiflags, bool blocking);
 };
 
 #endif
@@ -6,6 +6,53 @@ extern "C" {
 #include "EthernetClient.h"
 #include "EthernetServer.h"
 
+/* LwIP raw API calls, run by stm32_eth_api_call() */
+struct server_begin_args {
+  struct tcp_struct *server;
+  struct tcp_struct **clients;
+  uint16_t port;
+};
+
+static err_t eth_server_begin(void *arg)
+{
+  struct server_begin_args *args = (struct server_begin_args *)arg;
+  struct tcp_struct *server = args->server;
+  err_t err;
+
+  server->pcb = tcp_new();
+
+  if (server->pcb == NULL) {
+    return ERR_MEM;
+  }
+
+  tcp_struct_init(server, server->pcb, TCP_NONE);
+  server->clients = args->clients;
+  tcp_arg(server->pcb, server);
+
+  err = tcp_bind(server->pcb, IP_ADDR_ANY, args->port);
+  if (ERR_OK != err) {
+    memp_free(MEMP_TCP_PCB, server->pcb);
+    server->pcb = NULL;
+    return err;
+  }
+
+  server->pcb = tcp_listen(server->pcb);
+  tcp_accept(server->pcb, tcp_accept_callback);
+  return ERR_OK;
+}
+
+static err_t eth_server_end(void *arg)
+{
+  tcp_close((struct tcp_pcb *)arg);
+  return ERR_OK;
+}
+
+static err_t eth_server_free_client(void *arg)
+{
+  tcp_struct_free_data((struct tcp_struct *)arg);
+  return ERR_OK;
+}
+
 EthernetServer::EthernetServer(uint16_t port)
 {
   _port = port;
@@ -21,23 +68,11 @@ void EthernetServer::begin()
     return;
   }
 
-  _tcp_server.pcb = tcp_new();
-
-  if (_tcp_server.pcb == NULL) {
-    return;
-  }
-
-  tcp_arg(_tcp_server.pcb, &_tcp_client);
-  _tcp_server.state = TCP_NONE;
-
-  if (ERR_OK != tcp_bind(_tcp_server.pcb, IP_ADDR_ANY, _port)) {
-    memp_free(MEMP_TCP_PCB, _tcp_server.pcb);
-    _tcp_server.pcb = NULL;
-    return;
-  }
-
-  _tcp_server.pcb = tcp_listen(_tcp_server.pcb);
-  tcp_accept(_tcp_server.pcb, tcp_accept_callback);
+  struct server_begin_args args;
+  args.server = &_tcp_server;
+  args.clients = _tcp_client;
+  args.port = _port;
+  stm32_eth_api_call(eth_server_begin, &args);
 }
 
 void EthernetServer::begin(uint16_t port)
@@ -57,7 +92,7 @@ void EthernetServer::end(void)
     }
   }
   if (_tcp_server.pcb != NULL) {
-    tcp_close(_tcp_server.pcb);
+    stm32_eth_api_call(eth_server_end, _tcp_server.pcb);
     _tcp_server.pcb = NULL;
   }
 }
@@ -69,6 +104,7 @@ void EthernetServer::accept()
     if (_tcp_client[n] != NULL) {
       EthernetClient client(_tcp_client[n]);
       if (client.status() == TCP_CLOSING) {
+        stm32_eth_api_call(eth_server_free_client, _tcp_client[n]);
         mem_free(_tcp_client[n]);
         _tcp_client[n] = NULL;
       }
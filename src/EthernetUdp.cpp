@@ -32,6 +32,101 @@
 #include "lwip/igmp.h"
 #include "lwip/ip_addr.h"
 
+/* LwIP raw API calls, run by stm32_eth_api_call() */
+struct udp_begin_args {
+  struct udp_struct *udp;
+  ip_addr_t ipaddr;
+  uint16_t port;
+  bool multicast;
+};
+
+struct udp_send_args {
+  struct udp_struct *udp;
+  struct pbuf *data;
+  ip_addr_t ipaddr;
+  uint16_t port;
+};
+
+struct udp_parse_args {
+  struct udp_struct *udp;
+  uint32_t ip;
+  uint16_t port;
+  uint16_t available;
+};
+
+static err_t eth_udp_begin(void *arg)
+{
+  struct udp_begin_args *args = (struct udp_begin_args *)arg;
+  struct udp_struct *udp = args->udp;
+  err_t err;
+
+  udp->pcb = udp_new();
+
+  if (udp->pcb == NULL) {
+    return ERR_MEM;
+  }
+
+  if (args->multicast) {
+    err = udp_bind(udp->pcb, IP_ADDR_ANY, args->port);
+  } else {
+    err = udp_bind(udp->pcb, &args->ipaddr, args->port);
+  }
+
+  if (ERR_OK != err) {
+    udp_remove(udp->pcb);
+    udp->pcb = NULL;
+    return err;
+  }
+
+#if LWIP_IGMP
+  if (args->multicast) {
+    err = igmp_joingroup(IP_ADDR_ANY, &args->ipaddr);
+    if (ERR_OK != err) {
+      return err;
+    }
+  }
+#endif
+  udp_recv(udp->pcb, &udp_receive_callback, udp);
+  return ERR_OK;
+}
+
+static err_t eth_udp_stop(void *arg)
+{
+  struct udp_struct *udp = (struct udp_struct *)arg;
+
+  if (udp->pcb != NULL) {
+    udp_disconnect(udp->pcb);
+    udp_remove(udp->pcb);
+    udp->pcb = NULL;
+  }
+  return ERR_OK;
+}
+
+static err_t eth_udp_set_recv(void *arg)
+{
+  struct udp_struct *udp = (struct udp_struct *)arg;
+
+  udp_recv(udp->pcb, &udp_receive_callback, udp);
+  return ERR_OK;
+}
+
+static err_t eth_udp_send(void *arg)
+{
+  struct udp_send_args *args = (struct udp_send_args *)arg;
+
+  return udp_sendto(args->udp->pcb, args->data, &args->ipaddr, args->port);
+}
+
+static err_t eth_udp_parse(void *arg)
+{
+  struct udp_parse_args *args = (struct udp_parse_args *)arg;
+
+  args->available = args->udp->data.available;
+  args->ip = ip_addr_to_u32(&(args->udp->ip));
+  args->port = args->udp->port;
+  return ERR_OK;
+}
+
 /* Constructor */
 EthernetUDP::EthernetUDP() {}
 
@@ -49,33 +144,16 @@ uint8_t EthernetUDP::begin(IPAddress ip, uint16_t port, bool multicast)
     return 0;
   }
 
-  _udp.pcb = udp_new();
-
-  if (_udp.pcb == NULL) {
+  struct udp_begin_args args;
+  args.udp = &_udp;
+  u8_to_ip_addr(rawIPAddress(ip), &args.ipaddr);
+  args.port = port;
+  args.multicast = multicast;
+  if (ERR_OK != stm32_eth_api_call(eth_udp_begin, &args)) {
+    stm32_eth_scheduler();
     return 0;
   }
 
-  ip_addr_t ipaddr;
-  err_t err;
-  u8_to_ip_addr(rawIPAddress(ip), &ipaddr);
-  if (multicast) {
-    err = udp_bind(_udp.pcb, IP_ADDR_ANY, port);
-  } else {
-    err = udp_bind(_udp.pcb, &ipaddr, port);
-  }
-
-  if (ERR_OK != err) {
-    stop();
-    return 0;
-  }
-
-#if LWIP_IGMP
-  if ((multicast) && (ERR_OK != igmp_joingroup(IP_ADDR_ANY, &ipaddr))) {
-    return 0;
-  }
-#endif
-  udp_recv(_udp.pcb, &udp_receive_callback, &_udp);
-
   _port = port;
   _remaining = 0;
 
@@ -94,11 +172,7 @@ int EthernetUDP::available()
 /* Release any resources being used by this EthernetUDP instance */
 void EthernetUDP::stop()
 {
-  if (_udp.pcb != NULL) {
-    udp_disconnect(_udp.pcb);
-    udp_remove(_udp.pcb);
-    _udp.pcb = NULL;
-  }
+  stm32_eth_api_call(eth_udp_stop, &_udp);
 
   stm32_eth_scheduler();
 }
@@ -128,7 +202,7 @@ int EthernetUDP::beginPacket(IPAddress ip, uint16_t port)
   _sendtoIP = ip;
   _sendtoPort = port;
 
-  udp_recv(_udp.pcb, &udp_receive_callback, &_udp);
+  stm32_eth_api_call(eth_udp_set_recv, &_udp);
   stm32_eth_scheduler();
 
   return 1;
@@ -140,8 +214,12 @@ int EthernetUDP::endPacket()
     return 0;
   }
 
-  ip_addr_t ipaddr;
-  if (ERR_OK != udp_sendto(_udp.pcb, _data, u8_to_ip_addr(rawIPAddress(_sendtoIP), &ipaddr), _sendtoPort)) {
+  struct udp_send_args args;
+  args.udp = &_udp;
+  args.data = _data;
+  u8_to_ip_addr(rawIPAddress(_sendtoIP), &args.ipaddr);
+  args.port = _sendtoPort;
+  if (ERR_OK != stm32_eth_api_call(eth_udp_send, &args)) {
     _data = stm32_free_data(_data);
     return 0;
   }
@@ -179,10 +257,13 @@ int EthernetUDP::parsePacket()
 
   stm32_eth_scheduler();
 
-  if (_udp.data.available > 0) {
-    _remoteIP = IPAddress(ip_addr_to_u32(&(_udp.ip)));
-    _remotePort = _udp.port;
-    _remaining = _udp.data.available;
+  struct udp_parse_args args;
+  args.udp = &_udp;
+  stm32_eth_api_call(eth_udp_parse, &args);
+  if (args.available > 0) {
+    _remoteIP = IPAddress(args.ip);
+    _remotePort = args.port;
+    _remaining = args.available;
 
     return _remaining;
   }
@@ -240,15 +321,13 @@ int EthernetUDP::read(unsigned char *buffer, size_t len)
 
 int EthernetUDP::peek()
 {
-  uint8_t b;
   // Unlike recv, peek doesn't check to see if there's any data available, so we must.
   // If the user hasn't called parsePacket yet then return nothing otherwise they
   // may get the UDP header
   if (!_remaining) {
     return -1;
   }
-  b = pbuf_get_at(_udp.data.p, _udp.data.p->tot_len - _udp.data.available);
-  return b;
+  return stm32_peek_data(&(_udp.data), 0);
 }
 
 void EthernetUDP::flush()
@@ -99,6 +99,16 @@ EthernetLinkStatus EthernetClass::linkStatus()
   return (!stm32_eth_is_init()) ? Unknown : (stm32_eth_link_up() ? LinkON : LinkOFF);
 }
 
+uint16_t EthernetClass::linkSpeed()
+{
+  return (!stm32_eth_is_init()) ? 0 : stm32_eth_link_speed();
+}
+
+bool EthernetClass::linkFullDuplex()
+{
+  return (!stm32_eth_is_init()) ? false : (stm32_eth_link_full_duplex() != 0);
+}
+
 int EthernetClass::maintain()
 {
   int rc = DHCP_CHECK_NONE;
@@ -24,6 +24,9 @@ class EthernetClass {
     // Returns 0 if the DHCP configuration failed, and 1 if it succeeded
     int begin(unsigned long timeout = 60000, unsigned long responseTimeout = 4000);
     EthernetLinkStatus linkStatus();
+    // Negotiated link speed in Mb/s (10 or 100), 0 if the link is down
+    uint16_t linkSpeed();
+    bool linkFullDuplex();
     void begin(IPAddress local_ip);
     void begin(IPAddress local_ip, IPAddress subnet);
     void begin(IPAddress local_ip, IPAddress subnet, IPAddress gateway);
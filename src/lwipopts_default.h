@@ -22,8 +22,12 @@
 /**
  * NO_SYS==1: Provides VERY minimal functionality. Otherwise,
  * use lwIP facilities.
+ * NO_SYS==0: LwIP runs in its own thread, requires STM32FreeRTOS
+ * (see Thread options below).
  */
-#define NO_SYS                  1
+#ifndef NO_SYS
+  #define NO_SYS                  1
+#endif
 
 /* LWIP Debug options */
 #if !defined(NDEBUG)
@@ -58,8 +62,20 @@
  * SYS_LIGHTWEIGHT_PROT==1: if you want inter-task protection for certain
  * critical regions during buffer allocation, deallocation and memory
  * allocation and deallocation.
+ * The application allocates buffers in thread mode while the stack runs in
+ * the scheduler interrupt or the tcpip thread: the regions are protected by
+ * masking the interrupts (see utility/sys_arch.cpp).
  */
-#define SYS_LIGHTWEIGHT_PROT    0
+#define SYS_LIGHTWEIGHT_PROT    1
+
+/**
+ * LWIP_ALLOW_MEM_FREE_FROM_OTHER_CONTEXT==1: protect the heap with
+ * SYS_ARCH_PROTECT, needed without operating system as mem_malloc() and
+ * mem_free() are called from thread mode and interrupt.
+ */
+#if NO_SYS
+  #define LWIP_ALLOW_MEM_FREE_FROM_OTHER_CONTEXT 1
+#endif
 
 #define LWIP_NOASSERT
 
@@ -212,6 +228,32 @@ The STM32F4x7 allows computing and verifying the IP, UDP, TCP and ICMP checksums
 #endif
 
 
+/*
+   ------------------------------------
+   ---------- Thread options ----------
+   ------------------------------------
+*/
+#if !NO_SYS
+/**
+ * Without NO_SYS, the network functions of the library are forwarded to the
+ * tcpip thread (see stm32_eth_api_call()) and can be used from any task.
+ * TCPIP_THREAD_STACKSIZE is in words. The thread priority should be higher
+ * than the one of the tasks using the network.
+ */
+#ifndef TCPIP_THREAD_NAME
+  #define TCPIP_THREAD_NAME             "tcpip"
+#endif
+#ifndef TCPIP_THREAD_STACKSIZE
+  #define TCPIP_THREAD_STACKSIZE        512
+#endif
+#ifndef TCPIP_THREAD_PRIO
+  #define TCPIP_THREAD_PRIO             3
+#endif
+#ifndef TCPIP_MBOX_SIZE
+  #define TCPIP_MBOX_SIZE               16
+#endif
+#endif /* !NO_SYS */
+
 /*
    ----------------------------------------------
    ---------- Sequential layer options ----------
@@ -260,11 +302,135 @@ The STM32F4x7 allows computing and verifying the IP, UDP, TCP and ICMP checksums
     (see PinMap_Ethernet in PeripheralPins.c). */
 #define ETHERNET_RMII_MODE_CONFIGURATION 1
 
+/** PHY link detection. The PHY (LAN8742, DP83848, KSZ8081 or any IEEE 802.3
+  * clause 22 PHY) is identified at init. Uncomment ETH_PHY_INT_PIN and set
+  * the pin connected to the PHY interrupt output to read the link state as
+  * soon as it changes instead of every TIME_CHECK_ETH_LINK_STATE ms. The PHY
+  * address defaults to LAN8742A_PHY_ADDRESS. */
+//#define ETH_PHY_INT_PIN PB14
+//#define ETH_PHY_ADDRESS 0
+
+/** PHY registers are accessed without waiting for the MDIO bus: one access is
+  * started per scheduler run and completed on the next one. Up to
+  * ETH_MDIO_QUEUE_LEN accesses can be pending. An access not done after
+  * ETH_MDIO_TIMEOUT ms is run again, up to ETH_MDIO_RETRIES times, then
+  * given up: the link state is kept and read again at the next check. */
+//#define ETH_MDIO_QUEUE_LEN 8U
+//#define ETH_MDIO_TIMEOUT 10U
+//#define ETH_MDIO_RETRIES 2U
+
 /** Uncomment this line to use the ethernet input in interrupt mode.
+  * The interrupt only queues the received frames (up to ETH_RX_EVENT_QUEUE_LEN,
+  * power of 2) and wakes up the scheduler which passes them to the LwIP stack,
+  * so the interrupt priority (ETH_IRQ_PRIO, default 0x7) can be raised.
   * NOTE: LwIP stack documentation recommends to use the polling mode without
   * an operating system. */
 //#define ETH_INPUT_USE_IT 1
 
+/** Uncomment this line to switch between interrupt and polling modes at run
+  * time (implies ETH_INPUT_USE_IT). The Rx interrupt wakes up the scheduler
+  * then is masked: the scheduler polls the Rx ring, within the ETH_RX_BUDGET
+  * limits, until it is drained and enables the interrupt again. */
+//#define ETH_INPUT_USE_HYBRID 1
+
+/** Connection, DNS and DHCP waits sleep until the next interrupt, or block
+  * the calling task until a network event when STM32FreeRTOS is used, for at
+  * most ETH_WAIT_EVENT_SLICE ms (default 10) between two checks. */
+//#define ETH_WAIT_EVENT_SLICE 10U
+
+/** Uncomment this line to run the scheduler only when needed instead of every
+  * ms: the timer is programmed after each run for the next LwIP timeout, link
+  * check or DHCP process (at most ETH_SCHEDULER_MAX_SLEEP ms, default 1000).
+  * Received frames and API calls wake it up earlier. Requires
+  * ETH_INPUT_USE_IT or ETH_INPUT_USE_HYBRID and STM32 core 2.0.0 or later. */
+//#define ETH_SCHEDULER_TICKLESS 1
+
+/** API calls force a scheduler run only if a frame is received or queued, a
+  * PHY event is pending or a LwIP timeout is due. The run is delayed by up to
+  * ETH_SCHEDULER_KICK_WINDOW us (default 100) so that repeated calls trigger a
+  * single run, 0 runs the scheduler immediately. The LwIP calls of the
+  * application (read, write, connect...) are run at once by a scheduler
+  * interrupt handling only them, while the caller sleeps: the periodic run
+  * keeps its deadline. */
+//#define ETH_SCHEDULER_KICK_WINDOW 100U
+
+/** Uncomment this line to time each scheduler phase with the DWT cycle
+  * counter (Cortex-M3 or later). Durations are recorded in log2 histograms
+  * along with the longest timer interrupt and the number of late periodic
+  * runs, see stm32_eth_get_timing_stats() and stm32_eth_timing_percentile(). */
+//#define ETH_SCHEDULER_STATS 1
+
+/** Period of the scheduler timer in microseconds (default 1000), not used
+  * with ETH_SCHEDULER_TICKLESS. */
+//#define ETH_SCHEDULER_PERIOD_US 1000U
+
+/** Uncomment this line to split the scheduler in two tiers. The default
+  * timer (ETH_TIM_IRQ_PRIO, default 14 in this mode) only processes the
+  * frames and the application calls. PHY accesses, link check, LwIP timeouts
+  * and DHCP run every ETH_HOUSEKEEPING_PERIOD ms (default 5) from the
+  * interrupt of this second timer, at ETH_HOUSEKEEPING_IRQ_PRIO (default 15).
+  * Frames are only held back while a housekeeping step is inside LwIP.
+  * Requires NO_SYS 1 and cannot be used with ETH_SCHEDULER_TICKLESS. */
+//#define ETH_HOUSEKEEPING_TIMER TIM13
+//#define ETH_HOUSEKEEPING_PERIOD 5U
+//#define ETH_HOUSEKEEPING_IRQ_PRIO 15
+
+/** Maximum number of received frames passed to LwIP per scheduler run (or
+  * per receive interrupt). An optional time budget in microseconds can also
+  * be set, 0 disables it. Remaining frames are processed on next run. */
+//#define ETH_RX_BUDGET 8U
+//#define ETH_RX_BUDGET_US 0U
+
+/** Small EthernetClient::write() calls are combined in full TCP segments:
+  * queued data is sent on flush(), when the send buffer is full or
+  * ETH_TCP_WRITE_LINGER ms after the write (default 2, uses one
+  * MEMP_NUM_SYS_TIMEOUT entry). 0 sends the data at each write. */
+//#define ETH_TCP_WRITE_LINGER 2U
+
+/** The TCP receive window is reopened as EthernetClient reads the data, not
+  * on reception. ETH_TCP_RX_CAP (TCP_MSS to TCP_WND, default TCP_WND) limits
+  * the data received and not read per connection, from the second window. */
+//#define ETH_TCP_RX_CAP TCP_WND
+
+/** Received pbufs held by the TCP connections until read. ETH_RX_POOL_RESERVE
+  * pbufs (default 2) are kept for the other traffic. The clients of a server
+  * hold at most ETH_SERVER_RX_PBUF_QUOTA pbufs (default PBUF_POOL_SIZE -
+  * ETH_RX_POOL_RESERVE), a connection at most ETH_TCP_RX_PBUF_QUOTA (default
+  * half of it). Refused segments are counted, see
+  * stm32_eth_get_rx_quota_stats(). */
+//#define ETH_RX_POOL_RESERVE 2U
+//#define ETH_SERVER_RX_PBUF_QUOTA 6U
+//#define ETH_TCP_RX_PBUF_QUOTA 3U
+
+/** Received TCP segments up to ETH_RX_COMPACT_SIZE bytes (default 256, 0
+  * disables it) are copied to the LwIP heap to release their receive pbuf at
+  * once, when the connections hold ETH_RX_COMPACT_THRESHOLD receive pbufs or
+  * more (default PBUF_POOL_SIZE / 4). */
+//#define ETH_RX_COMPACT_SIZE 256U
+//#define ETH_RX_COMPACT_THRESHOLD 2U
+
+/** Uncomment this line to pass the Ethernet receive buffers to LwIP without
+  * copying them into PBUF_POOL pbufs. ETH_RX_SPARE_BUFNB (default 4) extra
+  * receive buffers are used to refill the DMA ring while the received ones
+  * are held by the stack. Frames are copied when no spare buffer is left.
+  * They are not counted in the pbuf quotas: a TCP connection holds at most
+  * ETH_TCP_RX_SPARE_QUOTA (default half of them), its following segments are
+  * copied to pool pbufs. */
+//#define ETH_RX_ZERO_COPY 1
+//#define ETH_RX_SPARE_BUFNB 4U
+//#define ETH_TCP_RX_SPARE_QUOTA 2U
+
+/** Uncomment this line to let the Ethernet DMA send the pbufs payload
+  * directly instead of copying them into the driver transmit buffers. Each
+  * pbuf of a frame uses one of the ETH_TXBUFNB descriptors and the frame is
+  * referenced until it is sent. Payloads must be in DMA accessible memory. */
+//#define ETH_TX_ZERO_COPY 1
+
+/** Number of frames queued when all transmit descriptors are in use. They are
+  * sent in order as soon as descriptors are released. 0 disables the queue:
+  * frames are then dropped. */
+//#define ETH_TX_QUEUE_LEN 8U
+
 #endif /* __LWIPOPTS_H__ */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -45,6 +45,7 @@
   ******************************************************************************
   */
 /* Includes ------------------------------------------------------------------*/
+#include "Arduino.h"
 #include "stm32_def.h"
 #include "lwip/timeouts.h"
 #include "netif/etharp.h"
@@ -53,6 +54,7 @@
 #include "PeripheralPins.h"
 #include "lwip/igmp.h"
 #include "stm32_eth.h"
+#include "stm32_eth_phy.h"
 #if !defined(STM32_CORE_VERSION) || (STM32_CORE_VERSION  <= 0x01050000)
   #include "variant.h"
 #endif
@@ -67,10 +69,74 @@ extern "C" {
 #define IFNAME0 's'
 #define IFNAME1 't'
 
-/* Definition of PHY SPECIAL CONTROL/STATUS REGISTER bitfield Auto-negotiation done indication */
-/* Placed in STM32Ethernet library instead of HAL conf to avoid compatibility dependence with Arduino_Core_STM32 */
-/* Could be moved from this file once Generic PHY is implemented */
-#define PHY_SR_AUTODONE ((uint16_t)0x1000)
+/* PHY address on the MDIO bus */
+#ifndef ETH_PHY_ADDRESS
+#define ETH_PHY_ADDRESS LAN8742A_PHY_ADDRESS
+#endif
+
+#ifdef ETH_RX_ZERO_COPY
+#if !LWIP_SUPPORT_CUSTOM_PBUF
+#error "ETH_RX_ZERO_COPY requires LWIP_SUPPORT_CUSTOM_PBUF to be enabled in lwipopts.h"
+#endif
+#endif /* ETH_RX_ZERO_COPY */
+
+#if defined(ETH_INPUT_USE_HYBRID) && !defined(ETH_INPUT_USE_IT)
+#define ETH_INPUT_USE_IT 1
+#endif
+
+#ifdef ETH_INPUT_USE_IT
+/* Ethernet interrupt priority */
+#ifndef ETH_IRQ_PRIO
+#define ETH_IRQ_PRIO 0x7
+#endif
+#ifndef ETH_IRQ_SUBPRIO
+#define ETH_IRQ_SUBPRIO 0
+#endif
+
+#ifndef ETH_INPUT_USE_HYBRID
+/* Received frames are notified to the scheduler through a queue */
+#define ETH_RX_USE_EVENT_QUEUE
+
+/* Size of the queue of the frames received under interrupt (power of 2) */
+#ifndef ETH_RX_EVENT_QUEUE_LEN
+#define ETH_RX_EVENT_QUEUE_LEN 8U
+#endif
+#if ((ETH_RX_EVENT_QUEUE_LEN & (ETH_RX_EVENT_QUEUE_LEN - 1)) != 0) || (ETH_RX_EVENT_QUEUE_LEN < ETH_RXBUFNB)
+#error "ETH_RX_EVENT_QUEUE_LEN must be a power of 2 greater or equal to ETH_RXBUFNB"
+#endif
+#endif /* !ETH_INPUT_USE_HYBRID */
+#endif /* ETH_INPUT_USE_IT */
+
+/* Number of PHY register accesses waiting for the MDIO bus */
+#ifndef ETH_MDIO_QUEUE_LEN
+#define ETH_MDIO_QUEUE_LEN 8U
+#endif
+
+/* Maximum duration of a PHY register access (ms) */
+#ifndef ETH_MDIO_TIMEOUT
+#define ETH_MDIO_TIMEOUT 10U
+#endif
+
+/* Number of times a timed out PHY register access is run again */
+#ifndef ETH_MDIO_RETRIES
+#define ETH_MDIO_RETRIES 2U
+#endif
+
+/* Number of frames waiting for free transmit descriptors, 0 to disable */
+#ifndef ETH_TX_QUEUE_LEN
+#define ETH_TX_QUEUE_LEN 8U
+#endif
+
+/* Maximum number of frames processed by a call to ethernetif_input() */
+#ifndef ETH_RX_BUDGET
+#define ETH_RX_BUDGET 8U
+#endif
+
+/* Maximum time in microseconds spent by a call to ethernetif_input().
+   At least one frame is processed. 0 disables the time budget. */
+#ifndef ETH_RX_BUDGET_US
+#define ETH_RX_BUDGET_US 0U
+#endif
 
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
@@ -89,13 +155,102 @@ __ALIGN_BEGIN ETH_DMADescTypeDef  DMATxDscrTab[ETH_TXBUFNB] __ALIGN_END;/* Ether
 #endif
 __ALIGN_BEGIN uint8_t Rx_Buff[ETH_RXBUFNB][ETH_RX_BUF_SIZE] __ALIGN_END; /* Ethernet Receive Buffer */
 
+#ifdef ETH_TX_ZERO_COPY
+/* Frame sent by each Tx descriptor, released once the DMA is done with it */
+static struct pbuf *TxPbuf[ETH_TXBUFNB];
+/* Oldest descriptor given to the DMA and number of descriptors in use */
+static uint32_t TxReclaimIndex = 0;
+static uint32_t TxInFlight = 0;
+#else
 #if defined ( __ICCARM__ ) /*!< IAR Compiler */
 #pragma data_alignment=4
 #endif
 __ALIGN_BEGIN uint8_t Tx_Buff[ETH_TXBUFNB][ETH_TX_BUF_SIZE] __ALIGN_END; /* Ethernet Transmit Buffer */
+#endif /* ETH_TX_ZERO_COPY */
+
+#if ETH_TX_QUEUE_LEN > 0
+/* Frames sent once transmit descriptors are released, oldest first */
+static struct pbuf *TxQueue[ETH_TX_QUEUE_LEN];
+static uint32_t TxQueueHead = 0;
+static uint32_t TxQueueCount = 0;
+#endif
+
+#ifdef ETH_RX_ZERO_COPY
+#if defined ( __ICCARM__ ) /*!< IAR Compiler */
+#pragma data_alignment=4
+#endif
+__ALIGN_BEGIN uint8_t Rx_Spare_Buff[ETH_RX_SPARE_BUFNB][ETH_RX_BUF_SIZE] __ALIGN_END; /* Ethernet Receive Spare Buffer */
+
+/* Receive buffer lent to the LwIP stack */
+typedef struct {
+  struct pbuf_custom pc;  /* must be the first member */
+  uint8_t *buffer;        /* spare buffer while free, lent buffer while in use */
+} RxPbuf_t;
+
+static RxPbuf_t RxPbuf[ETH_RX_SPARE_BUFNB];
+/* Stack of the RxPbuf not used by the LwIP stack */
+static RxPbuf_t *RxPbufFree[ETH_RX_SPARE_BUFNB];
+static uint32_t RxPbufFreeCount = 0;
+static uint8_t RxPbufInit = 0;
+#endif /* ETH_RX_ZERO_COPY */
+
+#ifdef ETH_RX_USE_EVENT_QUEUE
+/* Single producer (ETH interrupt) single consumer (scheduler) queue holding
+   the index of the last descriptor of each received frame */
+static volatile uint8_t RxEventQueue[ETH_RX_EVENT_QUEUE_LEN];
+static volatile uint32_t RxEventHead = 0; /* written by the interrupt only */
+static volatile uint32_t RxEventTail = 0; /* written by the scheduler only */
+/* Next descriptor checked by the interrupt */
+static ETH_DMADescTypeDef *RxEventDesc;
+/* Number of descriptors checked by the interrupt and released by the
+   scheduler: the interrupt never goes past the descriptors still in use */
+static volatile uint32_t RxDescChecked = 0;
+static volatile uint32_t RxDescReleased = 0;
+#endif /* ETH_RX_USE_EVENT_QUEUE */
+
+#ifdef ETH_INPUT_USE_HYBRID
+/* Set while the Rx interrupt is masked and the Rx ring polled */
+static volatile uint8_t RxPolling = 0;
+#endif
 
 static ETH_HandleTypeDef EthHandle;
 
+/* Driver of the PHY found at init */
+static const struct stm32_eth_phy_driver *EthPhy = NULL;
+
+#ifdef ETH_PHY_INT_PIN
+/* Set by the PHY interrupt, cleared when the link state is read */
+static volatile uint8_t EthPhyEvent = 0;
+#endif
+
+/* PHY register access, the callback gets the read value once the access is
+   done. It is not called when the access is given up after ETH_MDIO_RETRIES
+   timeouts. */
+typedef struct {
+  uint16_t reg;
+  uint16_t value;                   /* value to write */
+  uint8_t write;
+  uint8_t retries;                  /* timeouts so far */
+  void (*callback)(uint32_t value); /* may be NULL */
+} MdioOp_t;
+
+/* PHY register accesses processed in order by the scheduler */
+static MdioOp_t MdioQueue[ETH_MDIO_QUEUE_LEN];
+static uint32_t MdioHead = 0;
+static uint32_t MdioCount = 0;
+/* Set while the access at MdioHead is running on the bus */
+static uint8_t MdioBusy = 0;
+static uint32_t MdioTickStart = 0;
+
+/* Interface whose link is checked and set from the MDIO callbacks */
+static struct netif *LinkNetif = NULL;
+/* Set while the link state is read */
+static uint8_t LinkCheckPending = 0;
+/* Negotiated mode status register value */
+static uint32_t LinkStatus = 0;
+
+static struct ethernetif_stats EthStats;
+
 /* If default MAC fields is not defined use default values based on UID */
 #if !defined(MAC_ADDR0)
 #define MAC_ADDR0   0x00
@@ -120,9 +275,25 @@ static uint8_t macaddress[6] = { MAC_ADDR0, MAC_ADDR1, MAC_ADDR2, MAC_ADDR3, MAC
 #if LWIP_IGMP
 uint32_t ETH_HashTableHigh = 0x0;
 uint32_t ETH_HashTableLow = 0x0;
+/* Number of multicast addresses using each bit of the hash table */
+static uint8_t ETH_HashTableRefs[64];
+/* Multicast addresses set in the perfect filter registers MACA1 to MACA3 */
+static uint8_t ETH_FilterSlotMac[ETH_MAC_FILTER_SLOTS][6];
+static uint8_t ETH_FilterSlotRefs[ETH_MAC_FILTER_SLOTS];
 #endif
 
 /* Private function prototypes -----------------------------------------------*/
+#ifdef ETH_PHY_INT_PIN
+static void ethernetif_phy_irq(void);
+#endif
+static void low_level_mdio_abort(void);
+static uint8_t low_level_mdio_read(uint16_t reg, void (*callback)(uint32_t value));
+static uint8_t low_level_mdio_write(uint16_t reg, uint16_t value, void (*callback)(uint32_t value));
+static void ethernetif_mdio_failed(const MdioOp_t *op);
+#ifdef ETH_RX_ZERO_COPY
+static void rx_pbuf_free_custom(struct pbuf *p);
+#endif
+
 /* Private functions ---------------------------------------------------------*/
 /*******************************************************************************
                        Ethernet MSP Routines
@@ -162,7 +333,7 @@ void HAL_ETH_MspInit(ETH_HandleTypeDef *heth)
 
 #ifdef ETH_INPUT_USE_IT
   /* Enable the Ethernet global Interrupt */
-  HAL_NVIC_SetPriority(ETH_IRQn, 0x7, 0);
+  HAL_NVIC_SetPriority(ETH_IRQn, ETH_IRQ_PRIO, ETH_IRQ_SUBPRIO);
   HAL_NVIC_EnableIRQ(ETH_IRQn);
 #endif /* ETH_INPUT_USE_IT */
 
@@ -183,6 +354,11 @@ void HAL_ETH_MspInit(ETH_HandleTypeDef *heth)
 static void low_level_init(struct netif *netif)
 {
   uint32_t regvalue;
+  uint32_t phyid;
+  uint32_t i;
+#ifdef ETH_RX_ZERO_COPY
+  uint32_t rxbuffaddr[ETH_RXBUFNB];
+#endif
 
   EthHandle.Instance = ETH;
   EthHandle.Init.MACAddr = macaddress;
@@ -200,7 +376,10 @@ static void low_level_init(struct netif *netif)
   EthHandle.Init.RxMode = ETH_RXPOLLING_MODE;
 #endif /* ETH_INPUT_USE_IT */
   EthHandle.Init.ChecksumMode = ETH_CHECKSUM_BY_HARDWARE;
-  EthHandle.Init.PhyAddress = LAN8742A_PHY_ADDRESS;
+  EthHandle.Init.PhyAddress = ETH_PHY_ADDRESS;
+
+  /* PHY is accessed directly during init */
+  low_level_mdio_abort();
 
   /* configure ethernet peripheral (GPIOs, clocks, MAC, DMA) */
   if (HAL_ETH_Init(&EthHandle) == HAL_OK) {
@@ -208,12 +387,70 @@ static void low_level_init(struct netif *netif)
     netif->flags |= NETIF_FLAG_LINK_UP;
   }
 
+#if ETH_TX_QUEUE_LEN > 0
+  /* Drop the frames not sent */
+  while (TxQueueCount > 0) {
+    pbuf_free(TxQueue[TxQueueHead]);
+    TxQueue[TxQueueHead] = NULL;
+    TxQueueHead = (TxQueueHead + 1) % ETH_TX_QUEUE_LEN;
+    TxQueueCount--;
+  }
+  EthStats.tx_queue_depth = 0;
+#endif
+
+#ifdef ETH_TX_ZERO_COPY
+  /* Release the frames still referenced by the descriptors */
+  for (i = 0; i < ETH_TXBUFNB; i++) {
+    if (TxPbuf[i] != NULL) {
+      pbuf_free(TxPbuf[i]);
+      TxPbuf[i] = NULL;
+    }
+  }
+  TxReclaimIndex = 0;
+  TxInFlight = 0;
+
+  /* Initialize Tx Descriptors list: Chain Mode, buffers are set per frame */
+  HAL_ETH_DMATxDescListInit(&EthHandle, DMATxDscrTab, NULL, ETH_TXBUFNB);
+#else
   /* Initialize Tx Descriptors list: Chain Mode */
   HAL_ETH_DMATxDescListInit(&EthHandle, DMATxDscrTab, &Tx_Buff[0][0], ETH_TXBUFNB);
+#endif /* ETH_TX_ZERO_COPY */
+
+#ifdef ETH_RX_ZERO_COPY
+  if (RxPbufInit) {
+    /* Some buffers could still be lent to the stack: keep the ring ones */
+    for (i = 0; i < ETH_RXBUFNB; i++) {
+      rxbuffaddr[i] = DMARxDscrTab[i].Buffer1Addr;
+    }
+  }
+#endif
 
   /* Initialize Rx Descriptors list: Chain Mode  */
   HAL_ETH_DMARxDescListInit(&EthHandle, DMARxDscrTab, &Rx_Buff[0][0], ETH_RXBUFNB);
 
+#ifdef ETH_RX_USE_EVENT_QUEUE
+  /* Reception is not started yet: flush the received frames queue */
+  RxEventDesc = EthHandle.RxDesc;
+  RxEventTail = RxEventHead;
+  RxDescReleased = RxDescChecked;
+#endif
+
+#ifdef ETH_RX_ZERO_COPY
+  if (RxPbufInit) {
+    for (i = 0; i < ETH_RXBUFNB; i++) {
+      DMARxDscrTab[i].Buffer1Addr = rxbuffaddr[i];
+    }
+  } else {
+    for (i = 0; i < ETH_RX_SPARE_BUFNB; i++) {
+      RxPbuf[i].pc.custom_free_function = rx_pbuf_free_custom;
+      RxPbuf[i].buffer = &Rx_Spare_Buff[i][0];
+      RxPbufFree[i] = &RxPbuf[i];
+    }
+    RxPbufFreeCount = ETH_RX_SPARE_BUFNB;
+    RxPbufInit = 1;
+  }
+#endif
+
   /* set MAC hardware address length */
   netif->hwaddr_len = ETH_HWADDR_LEN;
 
@@ -237,36 +474,172 @@ static void low_level_init(struct netif *netif)
 #if LWIP_IGMP
   netif_set_igmp_mac_filter(netif, igmp_mac_filter);
 #endif
+  /* Identify the PHY */
+  HAL_ETH_ReadPHYRegister(&EthHandle, ETH_PHY_REG_IDR1, &regvalue);
+  phyid = regvalue << 16;
+  HAL_ETH_ReadPHYRegister(&EthHandle, ETH_PHY_REG_IDR2, &regvalue);
+  phyid |= regvalue & 0xFFFF;
+  EthPhy = stm32_eth_phy_find(phyid);
+
   /**** Configure PHY to generate an interrupt when Eth Link state changes ****/
-  /* Read Register Configuration */
-  HAL_ETH_ReadPHYRegister(&EthHandle, PHY_IMR, &regvalue);
+  for (i = 0; i < ETH_PHY_INT_CTRL_NB; i++) {
+    if (EthPhy->int_ctrl_reg[i] != 0) {
+      /* Read Register Configuration */
+      HAL_ETH_ReadPHYRegister(&EthHandle, EthPhy->int_ctrl_reg[i], &regvalue);
 
-  regvalue |= PHY_ISFR_INT4;
+      regvalue |= EthPhy->int_ctrl_val[i];
 
-  /* Enable Interrupt on change of link status */
-  HAL_ETH_WritePHYRegister(&EthHandle, PHY_IMR, regvalue);
+      /* Enable Interrupt on change of link status */
+      HAL_ETH_WritePHYRegister(&EthHandle, EthPhy->int_ctrl_reg[i], regvalue);
+    }
+  }
+#ifdef ETH_PHY_INT_PIN
+  /* PHY interrupt output is active low */
+  pinMode(ETH_PHY_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(ETH_PHY_INT_PIN), ethernetif_phy_irq, FALLING);
+#endif
 #if LWIP_IGMP
   ETH_HashTableHigh = EthHandle.Instance->MACHTHR;
   ETH_HashTableLow = EthHandle.Instance->MACHTLR;
+
+  /* Multicast frames pass when matching a perfect filter or the hash table */
+  regvalue = (EthHandle.Instance->MACFFR & ~ETH_MACFFR_PAM) | ETH_MACFFR_HPF | ETH_MACFFR_HM;
+  EthHandle.Instance->MACFFR = regvalue;
+  /* Wait until the write operation will be taken into account */
+  regvalue = EthHandle.Instance->MACFFR;
+  HAL_Delay(ETH_REG_WRITE_DELAY);
+  EthHandle.Instance->MACFFR = regvalue;
 #endif
 }
 
+#ifdef ETH_TX_ZERO_COPY
 /**
-  * @brief This function should do the actual transmission of the packet. The packet is
-  * contained in the pbuf that is passed to the function. This pbuf
-  * might be chained.
+  * @brief Release the frames whose transmission is complete. The DMA gives
+  * back the descriptors in order.
+  */
+static void low_level_tx_reclaim(void)
+{
+  while ((TxInFlight > 0) && ((DMATxDscrTab[TxReclaimIndex].Status & ETH_DMATXDESC_OWN) == (uint32_t)RESET)) {
+    if (TxPbuf[TxReclaimIndex] != NULL) {
+      pbuf_free(TxPbuf[TxReclaimIndex]);
+      TxPbuf[TxReclaimIndex] = NULL;
+    }
+    TxReclaimIndex = (TxReclaimIndex + 1) % ETH_TXBUFNB;
+    TxInFlight--;
+  }
+}
+
+/**
+  * @brief Attach each pbuf of the frame to a transmit descriptor and give
+  * them to the DMA. The frame is referenced until its transmission is
+  * complete, or copied first if its payload could change meanwhile.
   *
-  * @param netif the lwip network interface structure for this ethernetif
   * @param p the MAC packet to send (e.g. IP packet including MAC addresses and type)
   * @return ERR_OK if the packet could be sent
-  *         an err_t value if the packet couldn't be sent
+  *         ERR_USE if not enough transmit descriptors are available
+  *         ERR_MEM if the frame had to be copied and memory is missing
+  */
+static err_t low_level_transmit_zero_copy(struct pbuf *p)
+{
+  err_t errval;
+  struct pbuf *q;
+  __IO ETH_DMADescTypeDef *DmaTxDesc;
+  __IO ETH_DMADescTypeDef *FirstTxDesc;
+  uint32_t segcount = 0;
+  uint32_t seg = 0;
+  uint32_t status;
+  uint8_t needs_copy = 0;
+
+  low_level_tx_reclaim();
+
+  for (q = p; q != NULL; q = q->next) {
+    if (q->len > 0) {
+      segcount++;
+    }
+    if (PBUF_NEEDS_COPY(q)) {
+      needs_copy = 1;
+    }
+  }
+
+  if (segcount == 0) {
+    return ERR_OK;
+  }
+
+  if ((segcount > ETH_TXBUFNB) || needs_copy) {
+    /* Too many segments for the descriptor ring, or a payload that could
+       change once low_level_output() returns: send a contiguous copy */
+    q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+    if (q == NULL) {
+      return ERR_MEM;
+    }
+    errval = low_level_transmit_zero_copy(q);
+    /* Descriptors hold their own reference */
+    pbuf_free(q);
+    return errval;
+  }
+
+  if (segcount > (ETH_TXBUFNB - TxInFlight)) {
+    return ERR_USE;
+  }
+
+  FirstTxDesc = EthHandle.TxDesc;
+  DmaTxDesc = FirstTxDesc;
+
+  for (q = p; q != NULL; q = q->next) {
+    if (q->len == 0) {
+      continue;
+    }
+    seg++;
+
+    /* Point the descriptor to the pbuf payload */
+    DmaTxDesc->Buffer1Addr = (uint32_t)q->payload;
+    DmaTxDesc->ControlBufferSize = (q->len & ETH_DMATXDESC_TBS1);
+
+    status = DmaTxDesc->Status & ~(ETH_DMATXDESC_FS | ETH_DMATXDESC_LS);
+    if (seg == 1) {
+      status |= ETH_DMATXDESC_FS;
+    } else {
+      /* First descriptor is given last to the DMA */
+      status |= ETH_DMATXDESC_OWN;
+    }
+    if (seg == segcount) {
+      status |= ETH_DMATXDESC_LS;
+      /* Keep the frame until the DMA is done with it */
+      pbuf_ref(p);
+      TxPbuf[(ETH_DMADescTypeDef *)DmaTxDesc - DMATxDscrTab] = p;
+    }
+    DmaTxDesc->Status = status;
+
+    /* Point to next descriptor */
+    DmaTxDesc = (ETH_DMADescTypeDef *)(DmaTxDesc->Buffer2NextDescAddr);
+  }
+
+  TxInFlight += segcount;
+  EthHandle.TxDesc = (ETH_DMADescTypeDef *)DmaTxDesc;
+
+  /* Whole frame is ready: give it to the DMA */
+  __DMB();
+  FirstTxDesc->Status |= ETH_DMATXDESC_OWN;
+
+  /* When Tx Buffer unavailable flag is set: clear it and resume transmission */
+  if ((EthHandle.Instance->DMASR & ETH_DMASR_TBUS) != (uint32_t)RESET) {
+    /* Clear TBUS ETHERNET DMA flag */
+    EthHandle.Instance->DMASR = ETH_DMASR_TBUS;
+    /* Resume DMA transmission*/
+    EthHandle.Instance->DMATPDR = 0;
+  }
+  return ERR_OK;
+}
+#else
+/**
+  * @brief Copy the frame into the driver transmit buffers and give the
+  * descriptors to the DMA.
   *
-  * @note Returning ERR_MEM here if a DMA queue of your MAC is full can lead to
-  *       strange results. You might consider waiting for space in the DMA queue
-  *       to become available since the stack doesn't retry to send a packet
-  *       dropped because of memory failure (except for the TCP timers).
+  * @param p the MAC packet to send (e.g. IP packet including MAC addresses and type)
+  * @return ERR_OK if the packet could be sent
+  *         ERR_USE if the transmit descriptors are still owned by the DMA
   */
-static err_t low_level_output(struct netif *netif, struct pbuf *p)
+static err_t low_level_transmit(struct pbuf *p)
 {
   err_t errval;
   struct pbuf *q;
@@ -277,8 +650,6 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
   uint32_t byteslefttocopy = 0;
   uint32_t payloadoffset = 0;
 
-  UNUSED(netif);
-
   DmaTxDesc = EthHandle.TxDesc;
   bufferoffset = 0;
 
@@ -328,6 +699,27 @@ static err_t low_level_output(struct netif *netif, struct pbuf *p)
   errval = ERR_OK;
 
 error:
+  return errval;
+}
+#endif /* ETH_TX_ZERO_COPY */
+
+/**
+  * @brief Give the frame to the DMA.
+  *
+  * @param p the MAC packet to send (e.g. IP packet including MAC addresses and type)
+  * @return ERR_OK if the packet could be sent
+  *         ERR_USE if the transmit descriptors are still owned by the DMA
+  *         an err_t value if the packet couldn't be sent
+  */
+static err_t low_level_send(struct pbuf *p)
+{
+  err_t errval;
+
+#ifdef ETH_TX_ZERO_COPY
+  errval = low_level_transmit_zero_copy(p);
+#else
+  errval = low_level_transmit(p);
+#endif
 
   /* When Transmit Underflow flag is set, clear it and issue a Transmit Poll Demand to resume transmission */
   if ((EthHandle.Instance->DMASR & ETH_DMASR_TUS) != (uint32_t)RESET) {
@@ -340,6 +732,187 @@ error:
   return errval;
 }
 
+#if ETH_TX_QUEUE_LEN > 0
+/**
+  * @brief Send the queued frames while transmit descriptors are available.
+  */
+static void low_level_tx_flush(void)
+{
+  while (TxQueueCount > 0) {
+    if (low_level_send(TxQueue[TxQueueHead]) == ERR_USE) {
+      break;
+    }
+    /* Sent, or dropped if it could not be sent at all */
+    pbuf_free(TxQueue[TxQueueHead]);
+    TxQueue[TxQueueHead] = NULL;
+    TxQueueHead = (TxQueueHead + 1) % ETH_TX_QUEUE_LEN;
+    TxQueueCount--;
+  }
+  EthStats.tx_queue_depth = TxQueueCount;
+}
+
+/**
+  * @brief Queue a frame until transmit descriptors are available.
+  * The frame is referenced, or copied if its payload could change once
+  * low_level_output() returns.
+  *
+  * @param p the MAC packet to queue
+  * @return ERR_OK if the packet is queued
+  *         ERR_USE if the queue is full
+  *         ERR_MEM if the frame could not be copied
+  */
+static err_t low_level_tx_enqueue(struct pbuf *p)
+{
+  struct pbuf *q;
+
+  if (TxQueueCount >= ETH_TX_QUEUE_LEN) {
+    EthStats.tx_queue_overflow++;
+    return ERR_USE;
+  }
+
+  for (q = p; q != NULL; q = q->next) {
+    if (PBUF_NEEDS_COPY(q)) {
+      break;
+    }
+  }
+  if (q != NULL) {
+    p = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+    if (p == NULL) {
+      EthStats.tx_queue_overflow++;
+      return ERR_MEM;
+    }
+  } else {
+    pbuf_ref(p);
+  }
+
+  TxQueue[(TxQueueHead + TxQueueCount) % ETH_TX_QUEUE_LEN] = p;
+  TxQueueCount++;
+  EthStats.tx_queue_depth = TxQueueCount;
+  if (TxQueueCount > EthStats.tx_queue_max) {
+    EthStats.tx_queue_max = TxQueueCount;
+  }
+  return ERR_OK;
+}
+#endif /* ETH_TX_QUEUE_LEN > 0 */
+
+/**
+  * @brief This function should do the actual transmission of the packet. The packet is
+  * contained in the pbuf that is passed to the function. This pbuf
+  * might be chained.
+  * When the transmit descriptors are all used, the packet is queued and sent
+  * later by ethernetif_tx_process(), preserving the frames order.
+  *
+  * @param netif the lwip network interface structure for this ethernetif
+  * @param p the MAC packet to send (e.g. IP packet including MAC addresses and type)
+  * @return ERR_OK if the packet could be sent or queued
+  *         an err_t value if the packet couldn't be sent
+  *
+  * @note Returning ERR_MEM here if a DMA queue of your MAC is full can lead to
+  *       strange results. You might consider waiting for space in the DMA queue
+  *       to become available since the stack doesn't retry to send a packet
+  *       dropped because of memory failure (except for the TCP timers).
+  */
+static err_t low_level_output(struct netif *netif, struct pbuf *p)
+{
+  UNUSED(netif);
+
+#if ETH_TX_QUEUE_LEN > 0
+  err_t errval;
+
+  /* Older frames are sent first */
+  low_level_tx_flush();
+  if (TxQueueCount > 0) {
+    return low_level_tx_enqueue(p);
+  }
+
+  errval = low_level_send(p);
+  if (errval == ERR_USE) {
+    errval = low_level_tx_enqueue(p);
+  }
+  return errval;
+#else
+  return low_level_send(p);
+#endif
+}
+
+#ifdef ETH_RX_ZERO_COPY
+/**
+  * @brief Custom pbuf free function: called by the stack when a lent receive
+  * buffer is released. The buffer becomes a spare buffer again.
+  *
+  * @param p the custom pbuf to release
+  */
+static void rx_pbuf_free_custom(struct pbuf *p)
+{
+  RxPbuf_t *rxpbuf = (RxPbuf_t *)p;
+  uint32_t primask = __get_PRIMASK();
+
+  /* pbuf could be freed from the application context */
+  __disable_irq();
+  RxPbufFree[RxPbufFreeCount++] = rxpbuf;
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief Wrap the DMA buffers of the received frame in custom pbufs. Each
+  * buffer is swapped with a spare one in its descriptor so the DMA ring can
+  * be refilled immediately.
+  *
+  * @param len length of the received frame
+  * @return a pbuf chain referencing the received frame
+  *         NULL if there are not enough spare buffers
+  */
+static struct pbuf *low_level_input_zero_copy(uint32_t len)
+{
+  struct pbuf *p = NULL;
+  struct pbuf *q;
+  RxPbuf_t *rxpbuf[ETH_RXBUFNB];
+  uint8_t *buffer;
+  __IO ETH_DMADescTypeDef *dmarxdesc;
+  uint32_t segcount = EthHandle.RxFrameInfos.SegCount;
+  uint32_t seglen;
+  uint32_t primask;
+  uint32_t i;
+
+  if ((segcount == 0) || (segcount > ETH_RXBUFNB)) {
+    return NULL;
+  }
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if (RxPbufFreeCount < segcount) {
+    __set_PRIMASK(primask);
+    return NULL;
+  }
+  for (i = 0; i < segcount; i++) {
+    rxpbuf[i] = RxPbufFree[--RxPbufFreeCount];
+  }
+  __set_PRIMASK(primask);
+
+  dmarxdesc = EthHandle.RxFrameInfos.FSRxDesc;
+  for (i = 0; i < segcount; i++) {
+    seglen = (len > ETH_RX_BUF_SIZE) ? ETH_RX_BUF_SIZE : len;
+    len -= seglen;
+
+    /* Swap the received buffer with the spare one */
+    buffer = (uint8_t *)(dmarxdesc->Buffer1Addr);
+    dmarxdesc->Buffer1Addr = (uint32_t)rxpbuf[i]->buffer;
+    rxpbuf[i]->buffer = buffer;
+
+    q = pbuf_alloced_custom(PBUF_RAW, (u16_t)seglen, PBUF_REF, &rxpbuf[i]->pc, buffer, ETH_RX_BUF_SIZE);
+    if (p == NULL) {
+      p = q;
+    } else {
+      pbuf_cat(p, q);
+    }
+
+    /* Point to next descriptor */
+    dmarxdesc = (ETH_DMADescTypeDef *)(dmarxdesc->Buffer2NextDescAddr);
+  }
+  return p;
+}
+#endif /* ETH_RX_ZERO_COPY */
+
 /**
   * @brief Should allocate a pbuf and transfer the bytes of the incoming
   * packet from the interface into the pbuf.
@@ -371,6 +944,13 @@ static struct pbuf *low_level_input(struct netif *netif)
   buffer = (uint8_t *)EthHandle.RxFrameInfos.buffer;
 
   if (len > 0) {
+#ifdef ETH_RX_ZERO_COPY
+    /* Lend the received buffers to the stack instead of copying them */
+    p = low_level_input_zero_copy(len);
+    if (p != NULL) {
+      goto release;
+    }
+#endif
     /* We allocate a pbuf chain of pbufs from the Lwip buffer pool */
     p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
   }
@@ -403,6 +983,9 @@ static struct pbuf *low_level_input(struct netif *netif)
     }
   }
 
+#ifdef ETH_RX_ZERO_COPY
+release:
+#endif
   /* Release descriptors to DMA */
   /* Point to first descriptor */
   dmarxdesc = EthHandle.RxFrameInfos.FSRxDesc;
@@ -412,6 +995,10 @@ static struct pbuf *low_level_input(struct netif *netif)
     dmarxdesc = (ETH_DMADescTypeDef *)(dmarxdesc->Buffer2NextDescAddr);
   }
 
+#ifdef ETH_RX_USE_EVENT_QUEUE
+  RxDescReleased += EthHandle.RxFrameInfos.SegCount;
+#endif
+
   /* Clear Segment_Count */
   EthHandle.RxFrameInfos.SegCount = 0;
 
@@ -425,43 +1012,170 @@ static struct pbuf *low_level_input(struct netif *netif)
   return p;
 }
 
+/**
+  * @brief Check if a received frame is waiting to be processed
+  *
+  * @param None
+  * @return 1 if a frame is ready, else 0
+  */
+static uint8_t ethernetif_rx_pending(void)
+{
+#ifdef ETH_RX_USE_EVENT_QUEUE
+  return (RxEventTail != RxEventHead) ? 1 : 0;
+#else
+  return ((EthHandle.RxDesc->Status & ETH_DMARXDESC_OWN) == (uint32_t)RESET) ? 1 : 0;
+#endif
+}
+
 /**
   * @brief This function should be called when a packet is ready to be read
   * from the interface. It uses the function low_level_input() that
   * should handle the actual reception of bytes from the network
   * interface. Then the type of the received packet is determined and
   * the appropriate input function is called.
+  * Received packets are processed until the Rx descriptors ring is empty or
+  * the ETH_RX_BUDGET frames or ETH_RX_BUDGET_US microseconds budget is spent.
+  * In interrupt mode, only the frames notified by the interrupt are processed.
+  * In hybrid mode, the Rx interrupt is enabled again once the ring is drained.
   *
   * @param netif the lwip network interface structure for this ethernetif
+  * @return 1 if the budget was exhausted (packets could be pending), else 0
   */
-void ethernetif_input(struct netif *netif)
+uint8_t ethernetif_input(struct netif *netif)
 {
   err_t err;
   struct pbuf *p;
+  uint32_t frames = 0;
+  uint8_t drained = 0;
+#if ETH_RX_BUDGET_US > 0
+  uint32_t start = micros();
+#endif
+
+  while (frames < ETH_RX_BUDGET) {
+#if ETH_RX_BUDGET_US > 0
+    if ((frames > 0) && ((micros() - start) >= ETH_RX_BUDGET_US)) {
+      break;
+    }
+#endif
+    /* Stop when no more frame is ready */
+    if (!ethernetif_rx_pending()) {
+      drained = 1;
+      break;
+    }
+
+    /* move received packet into a new pbuf */
+    p = low_level_input(netif);
+    frames++;
+#ifdef ETH_RX_USE_EVENT_QUEUE
+    /* Frame handled, free its queue entry */
+    if (EthHandle.RxFrameInfos.LSRxDesc != &DMARxDscrTab[RxEventQueue[RxEventTail & (ETH_RX_EVENT_QUEUE_LEN - 1)]]) {
+      LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: unexpected Rx descriptor\n"));
+    }
+    __DMB();
+    RxEventTail++;
+#endif
+
+    /* no packet could be read, silently ignore this */
+    if (p == NULL) {
+      continue;
+    }
 
-  /* move received packet into a new pbuf */
-  p = low_level_input(netif);
+    /* entry point to the LwIP stack */
+    err = netif->input(p, netif);
 
-  /* no packet could be read, silently ignore this */
-  if (p == NULL) {
-    return;
+    if (err != ERR_OK) {
+      LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
+      pbuf_free(p);
+      p = NULL;
+    }
   }
 
-  /* entry point to the LwIP stack */
-  err = netif->input(p, netif);
+  /* Budget exhausted, remaining frames are processed on next call */
+  if (!drained && ethernetif_rx_pending()) {
+    EthStats.rx_budget_exhausted++;
+    return 1;
+  }
 
-  if (err != ERR_OK) {
-    LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
-    pbuf_free(p);
-    p = NULL;
+#ifdef ETH_INPUT_USE_HYBRID
+  if (RxPolling) {
+    /* Ring drained: back to interrupt mode. The flag is cleared first so
+       that a frame received from now on raises the interrupt. */
+    __HAL_ETH_DMA_CLEAR_IT(&EthHandle, ETH_DMA_IT_R | ETH_DMA_IT_NIS);
+    if (ethernetif_rx_pending()) {
+      return 1;
+    }
+    RxPolling = 0;
+    __HAL_ETH_DMA_ENABLE_IT(&EthHandle, ETH_DMA_IT_R);
   }
+#endif
+  return 0;
 }
 
 /**
-  * @brief Returns the current state
+  * @brief This function should be called periodically to process the
+  * transmit completions. Frames sent by the DMA are released and the
+  * queued frames are given to the freed descriptors.
   *
-  * @param None
-  * @return 0 not initialized else 1
+  * @param netif the lwip network interface structure for this ethernetif
+  */
+void ethernetif_tx_process(struct netif *netif)
+{
+  UNUSED(netif);
+
+#ifdef ETH_TX_ZERO_COPY
+  low_level_tx_reclaim();
+#endif
+#if ETH_TX_QUEUE_LEN > 0
+  low_level_tx_flush();
+#endif
+}
+
+/**
+  * @brief Check if the driver needs the scheduler to run soon: received frames
+  * not processed, frames waiting to be sent or released, PHY register accesses.
+  *
+  * @param None
+  * @return 1 if work is pending, else 0
+  */
+uint8_t ethernetif_work_pending(void)
+{
+#ifdef ETH_INPUT_USE_HYBRID
+  if (RxPolling) {
+    return 1;
+  }
+#endif
+  if (ethernetif_rx_pending()) {
+    return 1;
+  }
+#if ETH_TX_QUEUE_LEN > 0
+  if (TxQueueCount > 0) {
+    return 1;
+  }
+#endif
+#ifdef ETH_TX_ZERO_COPY
+  if (TxInFlight > 0) {
+    return 1;
+  }
+#endif
+  return (MdioCount > 0) ? 1 : 0;
+}
+
+/**
+  * @brief Returns the driver statistics
+  *
+  * @param None
+  * @return pointer to the statistics counters
+  */
+const struct ethernetif_stats *ethernetif_get_stats(void)
+{
+  return &EthStats;
+}
+
+/**
+  * @brief Returns the current state
+  *
+  * @param None
+  * @return 0 not initialized else 1
   */
 uint8_t ethernetif_is_init(void)
 {
@@ -516,25 +1230,165 @@ u32_t sys_now(void)
 }
 
 /**
-  * @brief  This function sets the netif link status.
-  * @param  netif: the network interface
+  * @brief  Wait for the end of the running PHY register access and drop the
+  *         pending ones, before using the blocking HAL functions.
+  * @param  None
   * @retval None
   */
-void ethernetif_set_link(struct netif *netif)
+static void low_level_mdio_abort(void)
+{
+  uint32_t tickstart = HAL_GetTick();
+
+  if ((EthHandle.Instance != NULL) && MdioBusy) {
+    while (((EthHandle.Instance->MACMIIAR & ETH_MACMIIAR_MB) != (uint32_t)RESET) &&
+           ((HAL_GetTick() - tickstart) < ETH_MDIO_TIMEOUT));
+  }
+  MdioBusy = 0;
+  MdioCount = 0;
+  LinkCheckPending = 0;
+}
+
+/**
+  * @brief  Queue a PHY register access.
+  * @param  op: the access
+  * @retval 1 if queued, 0 if the queue is full
+  */
+static uint8_t low_level_mdio_submit(const MdioOp_t *op)
 {
-  uint32_t regvalue = 0;
+  if (MdioCount >= ETH_MDIO_QUEUE_LEN) {
+    return 0;
+  }
+  MdioQueue[(MdioHead + MdioCount) % ETH_MDIO_QUEUE_LEN] = *op;
+  MdioCount++;
+  return 1;
+}
 
-  /* Read PHY_MISR*/
-  HAL_ETH_ReadPHYRegister(&EthHandle, PHY_ISFR, &regvalue);
+/**
+  * @brief  Queue a PHY register read.
+  * @param  reg: PHY register
+  * @param  callback: function called with the register value
+  * @retval 1 if queued, 0 if the queue is full
+  */
+static uint8_t low_level_mdio_read(uint16_t reg, void (*callback)(uint32_t value))
+{
+  MdioOp_t op = {reg, 0, 0, 0, callback};
+  return low_level_mdio_submit(&op);
+}
 
+/**
+  * @brief  Queue a PHY register write.
+  * @param  reg: PHY register
+  * @param  value: value to write
+  * @param  callback: function called once the register is written, may be NULL
+  * @retval 1 if queued, 0 if the queue is full
+  */
+static uint8_t low_level_mdio_write(uint16_t reg, uint16_t value, void (*callback)(uint32_t value))
+{
+  MdioOp_t op = {reg, value, 1, 0, callback};
+  return low_level_mdio_submit(&op);
+}
+
+/**
+  * @brief  Start the PHY register access at the head of the queue.
+  * @param  None
+  * @retval None
+  */
+static void low_level_mdio_start(void)
+{
+  MdioOp_t *op = &MdioQueue[MdioHead];
+  uint32_t tmpreg;
+
+  /* Keep only the CSR Clock Range CR[2:0] bits value */
+  tmpreg = EthHandle.Instance->MACMIIAR & ~ETH_MACMIIAR_CR_MASK;
+  tmpreg |= (((uint32_t)EthHandle.Init.PhyAddress << 11) & ETH_MACMIIAR_PA);
+  tmpreg |= (((uint32_t)op->reg << 6) & ETH_MACMIIAR_MR);
+  if (op->write) {
+    tmpreg |= ETH_MACMIIAR_MW;
+    EthHandle.Instance->MACMIIDR = op->value;
+  }
+  tmpreg |= ETH_MACMIIAR_MB;
+
+  MdioBusy = 1;
+  MdioTickStart = HAL_GetTick();
+  EthHandle.Instance->MACMIIAR = tmpreg;
+}
+
+/**
+  * @brief  This function should be called periodically to run the PHY
+  *         register accesses. It never waits for the MDIO bus: a running
+  *         access is completed on a later call, then the next one is started.
+  *         A timed out access is run again, up to ETH_MDIO_RETRIES times.
+  * @param  None
+  * @retval None
+  */
+void ethernetif_mdio_process(void)
+{
+  MdioOp_t op;
+  uint32_t value = 0;
+
+  if (MdioBusy) {
+    if ((EthHandle.Instance->MACMIIAR & ETH_MACMIIAR_MB) != (uint32_t)RESET) {
+      if ((HAL_GetTick() - MdioTickStart) < ETH_MDIO_TIMEOUT) {
+        return;
+      }
+      MdioBusy = 0;
+      if (MdioQueue[MdioHead].retries < ETH_MDIO_RETRIES) {
+        MdioQueue[MdioHead].retries++;
+      } else {
+        op = MdioQueue[MdioHead];
+        MdioHead = (MdioHead + 1) % ETH_MDIO_QUEUE_LEN;
+        MdioCount--;
+        ethernetif_mdio_failed(&op);
+      }
+    } else {
+      if (!MdioQueue[MdioHead].write) {
+        value = (uint16_t)(EthHandle.Instance->MACMIIDR);
+      }
+
+      /* Free the entry before the callback which can queue new accesses */
+      op = MdioQueue[MdioHead];
+      MdioHead = (MdioHead + 1) % ETH_MDIO_QUEUE_LEN;
+      MdioCount--;
+      MdioBusy = 0;
+      if (op.callback != NULL) {
+        op.callback(value);
+      }
+    }
+  }
+
+  /* The MAC registers must not be written while the bus is still busy */
+  if ((MdioCount > 0) && !MdioBusy &&
+      ((EthHandle.Instance->MACMIIAR & ETH_MACMIIAR_MB) == (uint32_t)RESET)) {
+    low_level_mdio_start();
+  }
+}
+
+/**
+  * @brief  PHY interrupt status read: a link event forces the link down, it is
+  *         set up again by the basic status read if needed.
+  * @param  value: PHY interrupt status register
+  * @retval None
+  */
+static void ethernetif_link_int_status(uint32_t value)
+{
   /* Check whether the link interrupt has occurred or not */
-  if ((regvalue & PHY_ISFR_INT4) != (uint16_t)RESET) {
-    netif_set_link_down(netif);
+  if ((value & EthPhy->int_link) != (uint16_t)RESET) {
+    netif_set_link_down(LinkNetif);
   }
+}
 
-  HAL_ETH_ReadPHYRegister(&EthHandle, PHY_BSR, &regvalue);
+/**
+  * @brief  PHY basic status read: set the netif link status.
+  * @param  value: PHY basic status register
+  * @retval None
+  */
+static void ethernetif_link_status(uint32_t value)
+{
+  struct netif *netif = LinkNetif;
+
+  LinkCheckPending = 0;
 
-  if ((regvalue & PHY_LINKED_STATUS) != (uint16_t)RESET) {
+  if ((value & PHY_LINKED_STATUS) != (uint16_t)RESET) {
 #if LWIP_IGMP
     if (!(netif->flags & NETIF_FLAG_IGMP)) {
       netif->flags |= NETIF_FLAG_IGMP;
@@ -543,67 +1397,259 @@ void ethernetif_set_link(struct netif *netif)
     }
 #endif
     netif_set_link_up(netif);
+  } else {
+    netif_set_link_down(netif);
+  }
+}
+
+/**
+  * @brief  This function sets the netif link status.
+  *         The PHY registers are read asynchronously, the link status is
+  *         updated once the accesses are done by ethernetif_mdio_process().
+  * @param  netif: the network interface
+  * @retval None
+  */
+void ethernetif_set_link(struct netif *netif)
+{
+  if (LinkCheckPending) {
+    /* Previous check not done yet */
+    return;
+  }
+  LinkNetif = netif;
+
+#ifdef ETH_PHY_INT_PIN
+  EthPhyEvent = 0;
+#endif
+
+  if (EthPhy->int_status_reg != 0) {
+    /* Read the PHY interrupt status, this also clears it */
+    low_level_mdio_read(EthPhy->int_status_reg, ethernetif_link_int_status);
+  }
+  LinkCheckPending = low_level_mdio_read(PHY_BSR, ethernetif_link_status);
+}
+
+/**
+  * @brief  Check if the PHY signaled a link change not processed yet
+  *         by ethernetif_set_link().
+  * @param  None
+  * @retval 1 if the link state has to be read, else 0
+  */
+uint8_t ethernetif_link_event(void)
+{
+#ifdef ETH_PHY_INT_PIN
+  return EthPhyEvent;
+#else
+  return 0;
+#endif
+}
+
+#ifdef ETH_PHY_INT_PIN
+/**
+  * @brief  PHY interrupt pin callback
+  * @param  None
+  * @retval None
+  */
+static void ethernetif_phy_irq(void)
+{
+  EthPhyEvent = 1;
+#if defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
+  /* Read the link state as soon as possible */
+  stm32_eth_scheduler();
+#endif
+}
+#endif /* ETH_PHY_INT_PIN */
+
+/**
+  * @brief  Apply the link mode to the MAC and restart it.
+  * @param  None
+  * @retval None
+  */
+static void ethernetif_link_config_mac(void)
+{
+  if (!netif_is_link_up(LinkNetif)) {
+    /* Link lost while the PHY was read */
+    return;
+  }
+
+  /* ETHERNET MAC Re-Configuration */
+  HAL_ETH_ConfigMAC(&EthHandle, (ETH_MACInitTypeDef *) NULL);
+
+  /* Restart MAC interface */
+  HAL_ETH_Start(&EthHandle);
+
+  ethernetif_notify_conn_changed(LinkNetif);
+}
+
+/**
+  * @brief  PHY control register written: configure the MAC with the same mode.
+  * @param  value: unused
+  * @retval None
+  */
+static void ethernetif_link_fixed_done(uint32_t value)
+{
+  UNUSED(value);
+  ethernetif_link_config_mac();
+}
+
+/**
+  * @brief  Force the PHY to the configured link mode, the MAC is configured
+  *         once the PHY control register is written.
+  * @param  None
+  * @retval None
+  */
+static void ethernetif_link_config_fixed(void)
+{
+  /* Check parameters */
+  assert_param(IS_ETH_SPEED(EthHandle.Init.Speed));
+  assert_param(IS_ETH_DUPLEX_MODE(EthHandle.Init.DuplexMode));
+
+  /* Set MAC Speed and Duplex Mode to PHY */
+  if (!low_level_mdio_write(PHY_BCR, ((uint16_t)(EthHandle.Init.DuplexMode >> 3) |
+                                      (uint16_t)(EthHandle.Init.Speed >> 1)),
+                            ethernetif_link_fixed_done)) {
+    ethernetif_link_config_mac();
+  }
+}
+
+/**
+  * @brief  Link partner abilities read (or negotiated mode read when not
+  *         needed): configure the MAC with the negotiated mode.
+  * @param  lpa: PHY link partner abilities register
+  * @retval None
+  */
+static void ethernetif_link_lpa(uint32_t lpa)
+{
+  uint16_t speed;
+  uint8_t full_duplex;
+
+  stm32_eth_phy_get_mode(EthPhy, (uint16_t)LinkStatus, (uint16_t)lpa, &speed, &full_duplex);
+
+  /* Configure the MAC with the Duplex Mode fixed by the auto-negotiation process */
+  if (full_duplex) {
+    /* Set Ethernet duplex mode to Full-duplex following the auto-negotiation */
+    EthHandle.Init.DuplexMode = ETH_MODE_FULLDUPLEX;
+  } else {
+    /* Set Ethernet duplex mode to Half-duplex following the auto-negotiation */
+    EthHandle.Init.DuplexMode = ETH_MODE_HALFDUPLEX;
+  }
+  /* Configure the MAC with the speed fixed by the auto-negotiation process */
+  if (speed == 10) {
+    /* Set Ethernet speed to 10M following the auto-negotiation */
+    EthHandle.Init.Speed = ETH_SPEED_10M;
+  } else {
+    /* Set Ethernet speed to 100M following the auto-negotiation */
+    EthHandle.Init.Speed = ETH_SPEED_100M;
+  }
+
+  ethernetif_link_config_mac();
+}
+
+/**
+  * @brief  Negotiated mode read: read the link partner abilities if needed.
+  * @param  value: PHY register giving the negotiated mode
+  * @retval None
+  */
+static void ethernetif_link_mode(uint32_t value)
+{
+  LinkStatus = value;
+
+  if ((EthPhy->lpa_reg == 0) || !low_level_mdio_read(EthPhy->lpa_reg, ethernetif_link_lpa)) {
+    ethernetif_link_lpa(0);
+  }
+}
+
+/**
+  * @brief  Auto-negotiation status read: read the negotiated mode, or force
+  *         the configured one if the auto-negotiation is not done.
+  * @param  value: PHY register holding the auto-negotiation done bit
+  * @retval None
+  */
+static void ethernetif_link_autoneg(uint32_t value)
+{
+  /* Check Auto negotiation */
+  if ((value & EthPhy->an_done) != EthPhy->an_done) {
+    ethernetif_link_config_fixed();
+  } else if (EthPhy->status_reg == EthPhy->an_reg) {
+    ethernetif_link_mode(value);
+  } else if (!low_level_mdio_read(EthPhy->status_reg, ethernetif_link_mode)) {
+    ethernetif_link_config_fixed();
+  }
+}
+
+/**
+  * @brief  PHY register access given up after ETH_MDIO_RETRIES timeouts. The
+  *         link state is kept until the next check reads it again. An
+  *         interrupted link configuration is restarted by setting the link
+  *         down, the next check brings it up again.
+  * @param  op: the failed access
+  * @retval None
+  */
+static void ethernetif_mdio_failed(const MdioOp_t *op)
+{
+  EthStats.mdio_failures++;
+
+  if (op->callback == ethernetif_link_status) {
+    LinkCheckPending = 0;
+  } else if ((op->callback != NULL) && (op->callback != ethernetif_link_int_status)) {
+    netif_set_link_down(LinkNetif);
   }
 }
 
 /**
   * @brief  Link callback function, this function is called on change of link status
   *         to update low level driver configuration.
+  *         When the link is up, the PHY registers are read asynchronously and
+  *         the MAC is configured once the accesses are done.
   * @param  netif: The network interface
   * @retval None
   */
 void ethernetif_update_config(struct netif *netif)
 {
-  uint32_t regvalue = 0;
+  LinkNetif = netif;
 
   if (netif_is_link_up(netif)) {
     /* Restart the auto-negotiation */
-    if (EthHandle.Init.AutoNegotiation != ETH_AUTONEGOTIATION_DISABLE) {
-
-      /* Check Auto negotiation */
-      HAL_ETH_ReadPHYRegister(&EthHandle, PHY_SR, &regvalue);
-      if ((regvalue & PHY_SR_AUTODONE) != PHY_SR_AUTODONE) {
-        goto error;
-      }
-
-      /* Configure the MAC with the Duplex Mode fixed by the auto-negotiation process */
-      if ((regvalue & PHY_DUPLEX_STATUS) != (uint32_t)RESET) {
-        /* Set Ethernet duplex mode to Full-duplex following the auto-negotiation */
-        EthHandle.Init.DuplexMode = ETH_MODE_FULLDUPLEX;
-      } else {
-        /* Set Ethernet duplex mode to Half-duplex following the auto-negotiation */
-        EthHandle.Init.DuplexMode = ETH_MODE_HALFDUPLEX;
-      }
-      /* Configure the MAC with the speed fixed by the auto-negotiation process */
-      if (regvalue & PHY_SPEED_STATUS) {
-        /* Set Ethernet speed to 10M following the auto-negotiation */
-        EthHandle.Init.Speed = ETH_SPEED_10M;
-      } else {
-        /* Set Ethernet speed to 100M following the auto-negotiation */
-        EthHandle.Init.Speed = ETH_SPEED_100M;
-      }
-    } else { /* AutoNegotiation Disable */
-error :
-      /* Check parameters */
-      assert_param(IS_ETH_SPEED(EthHandle.Init.Speed));
-      assert_param(IS_ETH_DUPLEX_MODE(EthHandle.Init.DuplexMode));
-
-      /* Set MAC Speed and Duplex Mode to PHY */
-      HAL_ETH_WritePHYRegister(&EthHandle, PHY_BCR, ((uint16_t)(EthHandle.Init.DuplexMode >> 3) |
-                                                     (uint16_t)(EthHandle.Init.Speed >> 1)));
+    if ((EthHandle.Init.AutoNegotiation == ETH_AUTONEGOTIATION_DISABLE) ||
+        !low_level_mdio_read(EthPhy->an_reg, ethernetif_link_autoneg)) {
+      /* AutoNegotiation Disable */
+      ethernetif_link_config_fixed();
     }
-
-    /* ETHERNET MAC Re-Configuration */
-    HAL_ETH_ConfigMAC(&EthHandle, (ETH_MACInitTypeDef *) NULL);
-
-    /* Restart MAC interface */
-    HAL_ETH_Start(&EthHandle);
   } else {
     /* Stop MAC interface */
     HAL_ETH_Stop(&EthHandle);
+
+    ethernetif_notify_conn_changed(netif);
   }
+}
 
-  ethernetif_notify_conn_changed(netif);
+/**
+  * @brief  Returns the link speed configured in the MAC
+  * @param  None
+  * @retval 10 or 100 (Mb/s)
+  */
+uint16_t ethernetif_link_speed(void)
+{
+  return (EthHandle.Init.Speed == ETH_SPEED_10M) ? 10 : 100;
+}
+
+/**
+  * @brief  Returns the link duplex mode configured in the MAC
+  * @param  None
+  * @retval 1 for full duplex, 0 for half duplex
+  */
+uint8_t ethernetif_link_full_duplex(void)
+{
+  return (EthHandle.Init.DuplexMode == ETH_MODE_FULLDUPLEX) ? 1 : 0;
+}
+
+/**
+  * @brief  Returns the name of the PHY driver in use
+  * @param  None
+  * @retval PHY name, NULL if the interface is not initialized
+  */
+const char *ethernetif_phy_name(void)
+{
+  return (EthPhy != NULL) ? EthPhy->name : NULL;
 }
 
 /**
@@ -645,11 +1691,21 @@ void ethernetif_get_mac_addr(uint8_t *mac)
 }
 
 #if LWIP_IGMP
+/**
+  * @brief  LwIP callback adding or removing an IPv4 multicast group to the
+  *         MAC filter.
+  * @param  netif: the network interface
+  * @param  ip4_addr: the multicast group address
+  * @param  action: NETIF_ADD_MAC_FILTER or NETIF_DEL_MAC_FILTER
+  * @retval ERR_OK
+  */
 err_t igmp_mac_filter(struct netif *netif, const ip4_addr_t *ip4_addr, netif_mac_filter_action action)
 {
   uint8_t mac[6];
   const uint8_t *p = (const uint8_t *)ip4_addr;
 
+  UNUSED(netif);
+
   mac[0] = 0x01;
   mac[1] = 0x00;
   mac[2] = 0x5E;
@@ -657,9 +1713,13 @@ err_t igmp_mac_filter(struct netif *netif, const ip4_addr_t *ip4_addr, netif_mac
   mac[4] = *(p + 2);
   mac[5] = *(p + 3);
 
-  register_multicast_address(mac);
+  if (action == NETIF_DEL_MAC_FILTER) {
+    unregister_multicast_address(mac);
+  } else {
+    register_multicast_address(mac);
+  }
 
-  return 0;
+  return ERR_OK;
 }
 
 #ifndef HASH_BITS
@@ -685,41 +1745,231 @@ uint32_t ethcrc(const uint8_t *data, size_t length)
   return ~crc;
 }
 
-void register_multicast_address(const uint8_t *mac)
+/**
+  * @brief  Compute the hash table bit matching a MAC address.
+  * @param  mac: mac address
+  * @retval bit index (0 to 63)
+  */
+static uint8_t ethernetif_mac_hash(const uint8_t *mac)
 {
-  uint32_t crc;
-  uint8_t hash;
-
   /* Calculate crc32 value of mac address */
-  crc = ethcrc(mac, HASH_BITS);
+  uint32_t crc = ethcrc(mac, HASH_BITS);
 
   /*
    * Only upper HASH_BITS are used
    * which point to specific bit in the hash registers
    */
-  hash = (crc >> 26) & 0x3F;
+  return (crc >> 26) & 0x3F;
+}
+
+/**
+  * @brief  Write the hash table registers.
+  * @param  None
+  * @retval None
+  */
+static void ethernetif_update_hash_table(void)
+{
+  EthHandle.Instance->MACHTHR = ETH_HashTableHigh;
+  EthHandle.Instance->MACHTLR = ETH_HashTableLow;
+}
+
+/**
+  * @brief  Write a perfect filter address register.
+  * @param  slot: register index (0 for MACA1 to 2 for MACA3)
+  * @param  mac: mac address, NULL to disable the register
+  * @retval None
+  */
+static void ethernetif_update_filter_slot(uint8_t slot, const uint8_t *mac)
+{
+  __IO uint32_t *const hr[ETH_MAC_FILTER_SLOTS] = {
+    &EthHandle.Instance->MACA1HR, &EthHandle.Instance->MACA2HR, &EthHandle.Instance->MACA3HR
+  };
+  __IO uint32_t *const lr[ETH_MAC_FILTER_SLOTS] = {
+    &EthHandle.Instance->MACA1LR, &EthHandle.Instance->MACA2LR, &EthHandle.Instance->MACA3LR
+  };
+
+  /* Disable the address while it is updated */
+  *hr[slot] = 0;
+  if (mac != NULL) {
+    *lr[slot] = ((uint32_t)mac[3] << 24) | ((uint32_t)mac[2] << 16) | ((uint32_t)mac[1] << 8) | mac[0];
+    *hr[slot] = ETH_MACA1HR_AE | ((uint32_t)mac[5] << 8) | mac[4];
+  }
+}
+
+/**
+  * @brief  Find the perfect filter register holding a MAC address.
+  * @param  mac: mac address
+  * @retval register index, ETH_MAC_FILTER_SLOTS if not found
+  */
+static uint8_t ethernetif_find_filter_slot(const uint8_t *mac)
+{
+  uint8_t slot;
+
+  for (slot = 0; slot < ETH_MAC_FILTER_SLOTS; slot++) {
+    if ((ETH_FilterSlotRefs[slot] > 0) && (memcmp(ETH_FilterSlotMac[slot], mac, 6) == 0)) {
+      break;
+    }
+  }
+  return slot;
+}
+
+/**
+  * @brief  Add a reference to a multicast MAC address in the MAC filter.
+  *         The perfect filter registers are used first, then the hash table.
+  * @param  mac: mac address
+  * @retval None
+  */
+void register_multicast_address(const uint8_t *mac)
+{
+  uint8_t slot;
+  uint8_t hash;
+
+  slot = ethernetif_find_filter_slot(mac);
+  if (slot == ETH_MAC_FILTER_SLOTS) {
+    /* Look for a free perfect filter register */
+    for (slot = 0; slot < ETH_MAC_FILTER_SLOTS; slot++) {
+      if (ETH_FilterSlotRefs[slot] == 0) {
+        memcpy(ETH_FilterSlotMac[slot], mac, 6);
+        ethernetif_update_filter_slot(slot, mac);
+        break;
+      }
+    }
+  }
+  if ((slot < ETH_MAC_FILTER_SLOTS) && (ETH_FilterSlotRefs[slot] < UINT8_MAX)) {
+    ETH_FilterSlotRefs[slot]++;
+    return;
+  }
+
+  hash = ethernetif_mac_hash(mac);
+  if (ETH_HashTableRefs[hash] < UINT8_MAX) {
+    ETH_HashTableRefs[hash]++;
+  }
 
   if (hash > 31) {
-    ETH_HashTableHigh |= 1 << (hash - 32);
-    EthHandle.Instance->MACHTHR = ETH_HashTableHigh;
+    ETH_HashTableHigh |= 1UL << (hash - 32);
   } else {
-    ETH_HashTableLow |= 1 << hash;
-    EthHandle.Instance->MACHTLR = ETH_HashTableLow;
+    ETH_HashTableLow |= 1UL << hash;
+  }
+  ethernetif_update_hash_table();
+}
+
+/**
+  * @brief  Remove a reference to a multicast MAC address from the MAC filter.
+  *         The address is filtered out once it is no longer referenced.
+  * @param  mac: mac address
+  * @retval None
+  */
+void unregister_multicast_address(const uint8_t *mac)
+{
+  uint8_t slot;
+  uint8_t hash;
+
+  slot = ethernetif_find_filter_slot(mac);
+  if (slot < ETH_MAC_FILTER_SLOTS) {
+    if (--ETH_FilterSlotRefs[slot] == 0) {
+      ethernetif_update_filter_slot(slot, NULL);
+    }
+    return;
+  }
+
+  hash = ethernetif_mac_hash(mac);
+  if ((ETH_HashTableRefs[hash] == 0) || (--ETH_HashTableRefs[hash] > 0)) {
+    /* Unknown address or bit still used */
+    return;
+  }
+
+  if (hash > 31) {
+    ETH_HashTableHigh &= ~(1UL << (hash - 32));
+  } else {
+    ETH_HashTableLow &= ~(1UL << hash);
+  }
+  ethernetif_update_hash_table();
+}
+
+/**
+  * @brief  Get the multicast MAC filter state.
+  * @param  filter: filled with the hash table and perfect filter registers
+  * @retval None
+  */
+void ethernetif_get_mac_filter(struct ethernetif_mac_filter *filter)
+{
+  uint8_t slot;
+  uint8_t hash;
+
+  if (filter == NULL) {
+    return;
+  }
+
+  filter->hash_high = ETH_HashTableHigh;
+  filter->hash_low = ETH_HashTableLow;
+  filter->hash_refs = 0;
+  for (hash = 0; hash < 64; hash++) {
+    filter->hash_refs += ETH_HashTableRefs[hash];
+  }
+  for (slot = 0; slot < ETH_MAC_FILTER_SLOTS; slot++) {
+    memcpy(filter->slot_mac[slot], ETH_FilterSlotMac[slot], 6);
+    filter->slot_refs[slot] = ETH_FilterSlotRefs[slot];
   }
 }
 #endif /* LWIP_IGMP */
 
 
 #ifdef ETH_INPUT_USE_IT
+#ifdef ETH_INPUT_USE_HYBRID
+/**
+  * @brief  Ethernet Rx Transfer completed callback
+  *         Masks the Rx interrupt and lets the scheduler poll the Rx ring
+  *         until it is drained.
+  * @param  heth: ETH handle
+  * @retval None
+  */
+void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth)
+{
+  __HAL_ETH_DMA_DISABLE_IT(heth, ETH_DMA_IT_R);
+  RxPolling = 1;
+  EthStats.rx_interrupts++;
+#if defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
+  /* Do not wait the next tick to process the frames */
+  stm32_eth_scheduler();
+#endif
+}
+#else
 /**
   * @brief  Ethernet Rx Transfer completed callback
+  *         Only queues the frames received, they are passed to the LwIP
+  *         stack by the scheduler.
   * @param  heth: ETH handle
   * @retval None
   */
 void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth)
 {
-  ethernetif_input(&gnetif);
+  uint32_t head = RxEventHead;
+
+  UNUSED(heth);
+  EthStats.rx_interrupts++;
+
+  /* Walk the descriptors filled by the DMA since last interrupt */
+  while (((RxDescChecked - RxDescReleased) < ETH_RXBUFNB) &&
+         ((RxEventDesc->Status & ETH_DMARXDESC_OWN) == (uint32_t)RESET)) {
+    if ((RxEventDesc->Status & ETH_DMARXDESC_LS) != (uint32_t)RESET) {
+      RxEventQueue[head & (ETH_RX_EVENT_QUEUE_LEN - 1)] = (uint8_t)(RxEventDesc - DMARxDscrTab);
+      head++;
+    }
+    RxEventDesc = (ETH_DMADescTypeDef *)(RxEventDesc->Buffer2NextDescAddr);
+    RxDescChecked++;
+  }
+
+  if (head != RxEventHead) {
+    /* Publish the entries once written */
+    __DMB();
+    RxEventHead = head;
+#if defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
+    /* Do not wait the next tick to process them */
+    stm32_eth_scheduler();
+#endif
+  }
 }
+#endif /* ETH_INPUT_USE_HYBRID */
 
 /**
   * @brief  This function handles Ethernet interrupt request.
@@ -53,19 +53,59 @@ extern "C" {
 #include "lwip/err.h"
 #include "lwip/netif.h"
 /* Exported types ------------------------------------------------------------*/
+/* Driver statistics */
+#ifdef ETH_RX_ZERO_COPY
+/* Number of spare receive buffers used to refill the DMA ring while the
+   received ones are owned by the LwIP stack */
+#ifndef ETH_RX_SPARE_BUFNB
+#define ETH_RX_SPARE_BUFNB 4U
+#endif
+#endif /* ETH_RX_ZERO_COPY */
+
+struct ethernetif_stats {
+  uint32_t rx_budget_exhausted; /* ethernetif_input() calls stopped by the Rx budget */
+  uint32_t rx_interrupts;       /* Rx interrupts taken */
+  uint32_t tx_queue_depth;      /* frames waiting for transmit descriptors */
+  uint32_t tx_queue_max;        /* highest number of frames queued */
+  uint32_t tx_queue_overflow;   /* frames dropped, transmit queue full */
+  uint32_t mdio_failures;       /* PHY register accesses given up after timeouts */
+};
+
 uint8_t ethernetif_is_init(void);
 err_t ethernetif_init(struct netif *netif);
-void ethernetif_input(struct netif *netif);
+uint8_t ethernetif_input(struct netif *netif);
+void ethernetif_tx_process(struct netif *netif);
+uint8_t ethernetif_work_pending(void);
 void ethernetif_set_link(struct netif *netif);
+uint8_t ethernetif_link_event(void);
+void ethernetif_mdio_process(void);
+uint16_t ethernetif_link_speed(void);
+uint8_t ethernetif_link_full_duplex(void);
+const char *ethernetif_phy_name(void);
 void ethernetif_update_config(struct netif *netif);
 void ethernetif_notify_conn_changed(struct netif *netif);
 
 void ethernetif_set_mac_addr(const uint8_t *mac);
 void ethernetif_get_mac_addr(uint8_t *mac);
+const struct ethernetif_stats *ethernetif_get_stats(void);
 
 #if LWIP_IGMP
+/* Number of perfect filter registers used for multicast addresses (MACA1 to MACA3) */
+#define ETH_MAC_FILTER_SLOTS 3U
+
+/* Multicast MAC filter state */
+struct ethernetif_mac_filter {
+  uint32_t hash_high;                          /* MACHTHR register */
+  uint32_t hash_low;                           /* MACHTLR register */
+  uint32_t hash_refs;                          /* references to addresses filtered by hash */
+  uint8_t slot_mac[ETH_MAC_FILTER_SLOTS][6];   /* perfect filter addresses */
+  uint8_t slot_refs[ETH_MAC_FILTER_SLOTS];     /* references to each perfect filter address, 0 if unused */
+};
+
 err_t igmp_mac_filter(struct netif *netif, const ip4_addr_t *ip4_addr, netif_mac_filter_action action);
 void register_multicast_address(const uint8_t *mac);
+void unregister_multicast_address(const uint8_t *mac);
+void ethernetif_get_mac_filter(struct ethernetif_mac_filter *filter);
 #endif
 
 #ifdef __cplusplus
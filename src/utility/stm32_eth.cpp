@@ -46,9 +46,44 @@
 #include "lwip/dhcp.h"
 #include "lwip/prot/dhcp.h"
 #include "lwip/dns.h"
+#include "lwip/priv/tcp_priv.h"
+#if !NO_SYS
+  #include "lwip/tcpip.h"
+  #include "lwip/priv/tcpip_priv.h"
+#endif
+#if defined(__has_include)
+  #if __has_include(<STM32FreeRTOS.h>)
+    #include <STM32FreeRTOS.h>
+    #define ETH_WAIT_USE_FREERTOS
+  #endif
+#endif
+
+#if !NO_SYS
+#if !defined(ETH_WAIT_USE_FREERTOS)
+  #error "NO_SYS 0 requires the STM32FreeRTOS library"
+#endif
+#if !defined(STM32_CORE_VERSION) || (STM32_CORE_VERSION  <= 0x01060100)
+  #error "NO_SYS 0 requires STM32 core version later than 1.6.1"
+#endif
+#endif /* !NO_SYS */
+
+/*
+ * Without operating system, the LwIP calls of the application are queued and
+ * run by the scheduler, so that the stack is only used from its interrupt.
+ */
+#if NO_SYS && defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
+  #define ETH_API_USE_QUEUE
+#endif
 
 /* Check ethernet link status every seconds */
+#ifndef TIME_CHECK_ETH_LINK_STATE
+#ifdef ETH_PHY_INT_PIN
+/* Link changes are signaled by the PHY interrupt, only check from time to time */
+#define TIME_CHECK_ETH_LINK_STATE 10000U
+#else
 #define TIME_CHECK_ETH_LINK_STATE 500U
+#endif
+#endif
 
 /* Timeout for DNS request */
 #define TIMEOUT_DNS_REQUEST 10000U
@@ -56,6 +91,11 @@
 /* Maximum number of retries for DHCP request */
 #define MAX_DHCP_TRIES  4
 
+/* Maximum time spent in stm32_eth_wait_event() */
+#ifndef ETH_WAIT_EVENT_SLICE
+  #define ETH_WAIT_EVENT_SLICE 10U
+#endif
+
 /*
  * Defined a default timer used to call ethernet scheduler at regular interval
  * Could be redefined in the variant
@@ -67,6 +107,147 @@
   #warning "Default timer used to call ethernet scheduler at regular interval: TIM14"
 #endif
 
+#ifdef ETH_SCHEDULER_TICKLESS
+#if !defined(STM32_CORE_VERSION) || (STM32_CORE_VERSION  < 0x02000000)
+  #error "ETH_SCHEDULER_TICKLESS requires STM32 core version 2.0.0 or later"
+#endif
+#if !defined(ETH_INPUT_USE_IT) && !defined(ETH_INPUT_USE_HYBRID)
+  #error "ETH_SCHEDULER_TICKLESS requires ETH_INPUT_USE_IT or ETH_INPUT_USE_HYBRID"
+#endif
+/* Timer resolution in tickless mode */
+#define ETH_SCHEDULER_TICK_US     100U
+/* Maximum delay between two scheduler runs (ms), limited by the 16-bit timer */
+#ifndef ETH_SCHEDULER_MAX_SLEEP
+  #define ETH_SCHEDULER_MAX_SLEEP 1000U
+#endif
+#if (ETH_SCHEDULER_MAX_SLEEP * (1000U / ETH_SCHEDULER_TICK_US)) > 0xFFFFU
+  #error "ETH_SCHEDULER_MAX_SLEEP too high"
+#endif
+#endif /* ETH_SCHEDULER_TICKLESS */
+
+#ifdef ETH_SCHEDULER_STATS
+#if (__CORTEX_M < 3U)
+  #error "ETH_SCHEDULER_STATS requires the DWT cycle counter (Cortex-M3 or later)"
+#endif
+/* Record the duration of a scheduler phase started at t, then restart t */
+#define ETH_STATS_START(t)        uint32_t t = DWT->CYCCNT
+#define ETH_STATS_PHASE(phase, t) stm32_eth_stats_record(phase, &(t))
+#else
+#define ETH_STATS_START(t)
+#define ETH_STATS_PHASE(phase, t)
+#endif /* ETH_SCHEDULER_STATS */
+
+/*
+ * With ETH_HOUSEKEEPING_TIMER, the scheduler is split in two tiers: the
+ * DEFAULT_ETHERNET_TIMER interrupt only handles the frames and the application
+ * calls, the PHY, link, LwIP timeouts and DHCP are handled by the interrupt of
+ * this second timer, at a lower priority.
+ */
+#ifdef ETH_HOUSEKEEPING_TIMER
+#if !NO_SYS
+  #error "ETH_HOUSEKEEPING_TIMER requires NO_SYS 1"
+#endif
+#if !defined(STM32_CORE_VERSION) || (STM32_CORE_VERSION  <= 0x01060100)
+  #error "ETH_HOUSEKEEPING_TIMER requires STM32 core version later than 1.6.1"
+#endif
+#ifdef ETH_SCHEDULER_TICKLESS
+  #error "ETH_HOUSEKEEPING_TIMER can not be used with ETH_SCHEDULER_TICKLESS"
+#endif
+/* Housekeeping period (ms) */
+#ifndef ETH_HOUSEKEEPING_PERIOD
+  #define ETH_HOUSEKEEPING_PERIOD       5U
+#endif
+#ifndef ETH_HOUSEKEEPING_IRQ_PRIO
+  #define ETH_HOUSEKEEPING_IRQ_PRIO     15
+#endif
+#ifndef ETH_HOUSEKEEPING_IRQ_SUBPRIO
+  #define ETH_HOUSEKEEPING_IRQ_SUBPRIO  0
+#endif
+/* The frame processing preempts the housekeeping */
+#ifndef ETH_TIM_IRQ_PRIO
+  #define ETH_TIM_IRQ_PRIO              14
+#endif
+#if ETH_TIM_IRQ_PRIO >= ETH_HOUSEKEEPING_IRQ_PRIO
+  #error "ETH_TIM_IRQ_PRIO must be a higher priority (lower value) than ETH_HOUSEKEEPING_IRQ_PRIO"
+#endif
+/* Mark the LwIP calls of the housekeeping tier, see stm32_eth_core_unlock() */
+#define ETH_CORE_LOCK()    (gEthCoreBusy = 1)
+#define ETH_CORE_UNLOCK()  stm32_eth_core_unlock()
+#else
+#define ETH_CORE_LOCK()
+#define ETH_CORE_UNLOCK()
+#endif /* ETH_HOUSEKEEPING_TIMER */
+
+/*
+ * Delay (ms) before sending the data queued by EthernetClient::write(), so
+ * that small writes are sent in full segments. 0 sends at each write.
+ */
+#ifndef ETH_TCP_WRITE_LINGER
+  #define ETH_TCP_WRITE_LINGER 2U
+#endif
+
+/*
+ * Maximum data received and not read by the application per TCP connection
+ * (bytes). The receive window is only reopened as the data is read, so the
+ * sender stops when the application does not read.
+ */
+#ifndef ETH_TCP_RX_CAP
+  #define ETH_TCP_RX_CAP TCP_WND
+#endif
+#if (ETH_TCP_RX_CAP > TCP_WND) || (ETH_TCP_RX_CAP < TCP_MSS)
+  #error "ETH_TCP_RX_CAP must be between TCP_MSS and TCP_WND"
+#endif
+
+/*
+ * Received pbufs the TCP connections can hold until the application reads
+ * them: ETH_RX_POOL_RESERVE pbufs of the pool are kept for the other traffic
+ * (ARP, DHCP, UDP, new connections), a connection holds at most
+ * ETH_TCP_RX_PBUF_QUOTA pbufs and the clients of a server at most
+ * ETH_SERVER_RX_PBUF_QUOTA. Above, the segments are refused: LwIP keeps the
+ * last one and drops the following ones until it is accepted.
+ */
+#ifndef ETH_RX_POOL_RESERVE
+  #define ETH_RX_POOL_RESERVE 2U
+#endif
+#if ETH_RX_POOL_RESERVE >= PBUF_POOL_SIZE
+  #error "ETH_RX_POOL_RESERVE must be lower than PBUF_POOL_SIZE"
+#endif
+#ifndef ETH_SERVER_RX_PBUF_QUOTA
+  #define ETH_SERVER_RX_PBUF_QUOTA (PBUF_POOL_SIZE - ETH_RX_POOL_RESERVE)
+#endif
+#ifndef ETH_TCP_RX_PBUF_QUOTA
+  #define ETH_TCP_RX_PBUF_QUOTA ((ETH_SERVER_RX_PBUF_QUOTA + 1U) / 2U)
+#endif
+
+/*
+ * With ETH_RX_ZERO_COPY, the segments may hold spare receive buffers instead
+ * of pool pbufs. They are not counted in the quotas above: a connection holds
+ * at most ETH_TCP_RX_SPARE_QUOTA of them, the following segments are copied
+ * to pool pbufs so that the spare buffers stay available to the others.
+ */
+#ifdef ETH_RX_ZERO_COPY
+#ifndef ETH_TCP_RX_SPARE_QUOTA
+  #define ETH_TCP_RX_SPARE_QUOTA ((ETH_RX_SPARE_BUFNB + 1U) / 2U)
+#endif
+#endif
+
+/*
+ * Received TCP segments up to ETH_RX_COMPACT_SIZE bytes are copied to the
+ * LwIP heap, releasing their receive buffer at once, when the TCP connections
+ * already hold ETH_RX_COMPACT_THRESHOLD receive pbufs or more. 0 disables it.
+ */
+#ifndef ETH_RX_COMPACT_SIZE
+  #define ETH_RX_COMPACT_SIZE 256U
+#endif
+#ifndef ETH_RX_COMPACT_THRESHOLD
+  #define ETH_RX_COMPACT_THRESHOLD (PBUF_POOL_SIZE / 4U)
+#endif
+
+/* Scheduler period (us), not used with ETH_SCHEDULER_TICKLESS */
+#ifndef ETH_SCHEDULER_PERIOD_US
+  #define ETH_SCHEDULER_PERIOD_US 1000U
+#endif
+
 /* Interrupt priority */
 #ifndef ETH_TIM_IRQ_PRIO
   #define ETH_TIM_IRQ_PRIO       15 // Warning: it should be lower prio (higher value) than Systick
@@ -74,6 +255,14 @@
 #ifndef ETH_TIM_IRQ_SUBPRIO
   #define ETH_TIM_IRQ_SUBPRIO    0
 #endif
+
+/*
+ * Delay (us) before a run forced by stm32_eth_scheduler(): the calls made
+ * within this window are coalesced in a single run. 0 forces a run at each call.
+ */
+#ifndef ETH_SCHEDULER_KICK_WINDOW
+  #define ETH_SCHEDULER_KICK_WINDOW 100U
+#endif
 /* Ethernet configuration: user parameters */
 struct stm32_eth_config {
   ip_addr_t ipaddr;
@@ -99,6 +288,67 @@ static uint8_t DHCP_Started_by_user = 0;
 /* Ethernet link status periodic timer */
 static uint32_t gEhtLinkTickStart = 0;
 
+#if NO_SYS
+  /* Tick of the next LwIP timeout, updated after each scheduler run */
+  static volatile uint32_t gEthNextTimeout = 0;
+#else
+  /* Message posted to the tcpip thread to run the scheduler */
+  static struct tcpip_callback_msg *gEthSchedMsg = NULL;
+  /* Set while this message is waiting in the tcpip thread mailbox */
+  static volatile uint8_t gEthSchedPosted = 0;
+#endif
+
+#ifdef ETH_API_USE_QUEUE
+/* Call queued by stm32_eth_api_call(), run by the scheduler */
+struct stm32_eth_api_msg {
+  struct stm32_eth_api_msg *next;
+  stm32_eth_api_fn fn;
+  void *arg;
+  err_t err;
+  volatile uint8_t done;
+};
+
+/* Queued calls, last one first */
+static struct stm32_eth_api_msg *gEthApiQueue = NULL;
+/* Set when the timer was refreshed to run the queued calls only */
+static volatile uint8_t gEthApiKicked = 0;
+/* Timer counter restored after this run */
+static volatile uint32_t gEthApiResume = 0;
+/* Exception number of the scheduler interrupts, the LwIP context */
+static volatile uint32_t gEthSchedIpsr = 0;
+#ifdef ETH_HOUSEKEEPING_TIMER
+  static volatile uint32_t gEthHousekeepingIpsr = 0;
+#endif
+#endif
+
+/* Scheduler statistics */
+static struct stm32_eth_scheduler_stats gEthSchedStats;
+
+/* Received pbufs held by the TCP connections */
+static struct stm32_eth_rx_quota_stats gEthRxQuotaStats;
+
+#if ETH_TCP_WRITE_LINGER > 0
+  /* Set while the timeout sending the queued TCP data is pending */
+  static uint8_t gEthTcpLingerArmed = 0;
+#endif
+
+/* Set when the current timer period was shortened by stm32_eth_scheduler() */
+static volatile uint8_t gEthKicked = 0;
+
+#ifdef ETH_SCHEDULER_STATS
+  /* Scheduler timing statistics */
+  static struct stm32_eth_timing_stats gEthTimingStats;
+  /* Cycle counter value when the timer started its current period */
+  static uint32_t gEthTickStart = 0;
+  /* Current timer period in cycles */
+  static uint32_t gEthTickPeriod = 0;
+#endif
+
+#ifdef ETH_WAIT_USE_FREERTOS
+  /* Task waiting in stm32_eth_wait_event() */
+  static volatile TaskHandle_t gEthWaitTask = NULL;
+#endif
+
 #if !defined(STM32_CORE_VERSION) || (STM32_CORE_VERSION  <= 0x01060100)
   /* Handler for stimer */
   static stimer_t TimHandle;
@@ -106,15 +356,39 @@ static uint32_t gEhtLinkTickStart = 0;
   HardwareTimer *EthTim = NULL;
 #endif
 
+#ifdef ETH_HOUSEKEEPING_TIMER
+  /* Timer of the housekeeping tier */
+  static HardwareTimer *EthHousekeepingTim = NULL;
+  /* Set while the housekeeping tier runs LwIP code */
+  static volatile uint8_t gEthCoreBusy = 0;
+  /* Set when a frame processing run was skipped because of gEthCoreBusy */
+  static volatile uint8_t gEthFastDeferred = 0;
+#endif
+
 /*************************** Function prototype *******************************/
 static void Netif_Config(void);
 static err_t tcp_recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 static err_t tcp_sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len);
-static void tcp_err_callback(void *arg, err_t err);
 static void TIM_scheduler_Config(void);
+static void stm32_eth_signal_event(void);
+#ifdef ETH_SCHEDULER_TICKLESS
+  static void TIM_scheduler_Sleep(void);
+#endif
 #if defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
   void _stm32_eth_scheduler(void);
 #endif
+#if !NO_SYS
+  static uint8_t stm32_eth_post_scheduler(void);
+#endif
+#ifdef ETH_API_USE_QUEUE
+  static void stm32_eth_api_process(void);
+  static void stm32_eth_api_run(void);
+#endif
+static void stm32_eth_process_frames(void);
+static void stm32_eth_housekeeping(void);
+#ifdef ETH_HOUSEKEEPING_TIMER
+  static void stm32_eth_core_unlock(void);
+#endif
 
 /**
 * @brief  Configure the network interface
@@ -144,6 +418,106 @@ static void Netif_Config(void)
 #endif /* LWIP_NETIF_LINK_CALLBACK */
 }
 
+/**
+* @brief  Configure the network interface then notify the user about its
+*         status. Called through stm32_eth_api_call().
+* @param  arg: unused
+* @retval ERR_OK
+*/
+static err_t stm32_eth_netif_config(void *arg)
+{
+  UNUSED(arg);
+  Netif_Config();
+  User_notification(&gnetif);
+  return ERR_OK;
+}
+
+#if !NO_SYS
+/**
+* @brief  Run the scheduler in the tcpip thread.
+* @param  ctx: unused
+* @retval None
+*/
+static void stm32_eth_scheduler_msg(void *ctx)
+{
+  UNUSED(ctx);
+  gEthSchedPosted = 0;
+  _stm32_eth_scheduler();
+}
+
+/**
+* @brief  Post a scheduler run to the tcpip thread, unless one is already
+*         waiting in its mailbox. Can be called from an interrupt.
+* @param  None
+* @retval 1 if posted, 0 otherwise
+*/
+static uint8_t stm32_eth_post_scheduler(void)
+{
+  err_t err;
+
+  if ((gEthSchedMsg == NULL) || gEthSchedPosted) {
+    return 0;
+  }
+  gEthSchedPosted = 1;
+  if (__get_IPSR() != 0) {
+    err = tcpip_callbackmsg_trycallback_fromisr(gEthSchedMsg);
+  } else {
+    err = tcpip_callbackmsg_trycallback(gEthSchedMsg);
+  }
+  if (err != ERR_OK) {
+    /* Mailbox full, retried on next timer period */
+    gEthSchedPosted = 0;
+    return 0;
+  }
+  return 1;
+}
+#endif /* !NO_SYS */
+
+#ifdef ETH_SCHEDULER_STATS
+/**
+* @brief  Enable the DWT cycle counter used for the timing statistics.
+* @param  None
+* @retval None
+*/
+static void stm32_eth_stats_init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+#if (__CORTEX_M == 7U)
+  /* Unlock the DWT registers */
+  DWT->LAR = 0xC5ACCE55;
+#endif
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  gEthTimingStats.cycles_per_us = SystemCoreClock / 1000000U;
+  gEthTickStart = DWT->CYCCNT;
+  gEthTickPeriod = ETH_SCHEDULER_PERIOD_US * gEthTimingStats.cycles_per_us;
+}
+
+/**
+* @brief  Record the duration of a scheduler phase in its histogram.
+* @param  phase: one of stm32_eth_sched_phase
+* @param  start: cycle counter at the phase start, updated to the current one
+* @retval None
+*/
+static void stm32_eth_stats_record(uint8_t phase, uint32_t *start)
+{
+  struct stm32_eth_phase_stats *stats = &gEthTimingStats.phase[phase];
+  uint32_t cycles = DWT->CYCCNT - *start;
+
+  if ((stats->count == 0) || (cycles < stats->min)) {
+    stats->min = cycles;
+  }
+  if (cycles > stats->max) {
+    stats->max = cycles;
+  }
+  stats->count++;
+  /* Bucket n counts the durations from 2^n to 2^(n+1) - 1 cycles */
+  stats->hist[(cycles == 0) ? 0 : (31 - __builtin_clz(cycles))]++;
+
+  /* Do not account the recording time in the next phase */
+  *start = DWT->CYCCNT;
+}
+#endif /* ETH_SCHEDULER_STATS */
+
 /**
 * @brief  Scheduler callback. Call by a timer interrupt.
 * @param  htim: pointer to stimer_t or Hardware Timer
@@ -160,8 +534,72 @@ static void Netif_Config(void)
 #if (STM32_CORE_VERSION  <= 0x01080000)
   UNUSED(htim);
 #endif
-  _stm32_eth_scheduler();
+#ifdef ETH_SCHEDULER_STATS
+  uint32_t start = DWT->CYCCNT;
+#endif
+#ifdef ETH_API_USE_QUEUE
+  gEthSchedIpsr = __get_IPSR();
+  if (gEthApiKicked) {
+    /* Forced by stm32_eth_api_call(): the periodic run keeps its deadline */
+    gEthApiKicked = 0;
+    gEthSchedStats.api_runs++;
+    stm32_eth_api_run();
+  } else
+#endif
+  {
+#ifdef ETH_SCHEDULER_STATS
+    if (!gEthKicked) {
+      /* Periodic run later than 1.5 period */
+      if ((start - gEthTickStart) > (gEthTickPeriod + gEthTickPeriod / 2U)) {
+        gEthTimingStats.late_ticks++;
+      }
+    }
+#ifndef ETH_SCHEDULER_TICKLESS
+    gEthTickStart = start;
+#endif
+#endif /* ETH_SCHEDULER_STATS */
+#if NO_SYS
+    if (gEthKicked) {
+      gEthKicked = 0;
+      gEthSchedStats.forced_runs++;
+    } else {
+      gEthSchedStats.periodic_runs++;
+    }
+    _stm32_eth_scheduler();
+#else
+    /* LwIP runs in the tcpip thread */
+    if (stm32_eth_post_scheduler()) {
+      gEthSchedStats.periodic_runs++;
+    }
+#endif
+  }
+#ifdef ETH_SCHEDULER_STATS
+  start = DWT->CYCCNT - start;
+  if (start > gEthTimingStats.isr_max) {
+    gEthTimingStats.isr_max = start;
+  }
+#endif
+}
+
+#ifdef ETH_HOUSEKEEPING_TIMER
+/**
+* @brief  Housekeeping callback. Call by the ETH_HOUSEKEEPING_TIMER interrupt.
+* @param  htim: pointer to Hardware Timer
+* @retval None
+*/
+#if (STM32_CORE_VERSION  <= 0x01080000)
+  static void housekeeping_callback(HardwareTimer *htim)
+#else
+  static void housekeeping_callback(void)
+#endif
+{
+#if (STM32_CORE_VERSION  <= 0x01080000)
+  UNUSED(htim);
+#endif
+  gEthHousekeepingIpsr = __get_IPSR();
+  stm32_eth_housekeeping();
 }
+#endif /* ETH_HOUSEKEEPING_TIMER */
 
 #if !defined(STM32_CORE_VERSION) || (STM32_CORE_VERSION  <= 0x01060100)
 /**
@@ -192,11 +630,92 @@ static void TIM_scheduler_Config(void)
   EthTim->setInterruptPriority(ETH_TIM_IRQ_PRIO, ETH_TIM_IRQ_SUBPRIO);
   EthTim->setMode(1, TIMER_OUTPUT_COMPARE);
 
-  /* Timer set to 1ms */
-  EthTim->setOverflow(1000, MICROSEC_FORMAT);
+#ifdef ETH_SCHEDULER_TICKLESS
+  /* Period is updated after each scheduler run: it must apply immediately */
+  EthTim->setPreloadEnable(false);
+  EthTim->setPrescaleFactor(EthTim->getTimerClkFreq() / (1000000 / ETH_SCHEDULER_TICK_US));
+  /* First run after 1ms */
+  EthTim->setOverflow(1000 / ETH_SCHEDULER_TICK_US, TICK_FORMAT);
+#else
+  EthTim->setOverflow(ETH_SCHEDULER_PERIOD_US, MICROSEC_FORMAT);
+#endif
   EthTim->attachInterrupt(scheduler_callback);
   EthTim->resume();
+
+#ifdef ETH_HOUSEKEEPING_TIMER
+  EthHousekeepingTim = new HardwareTimer(ETH_HOUSEKEEPING_TIMER);
+  EthHousekeepingTim->setInterruptPriority(ETH_HOUSEKEEPING_IRQ_PRIO, ETH_HOUSEKEEPING_IRQ_SUBPRIO);
+  EthHousekeepingTim->setMode(1, TIMER_OUTPUT_COMPARE);
+  EthHousekeepingTim->setOverflow(ETH_HOUSEKEEPING_PERIOD * 1000U, MICROSEC_FORMAT);
+  EthHousekeepingTim->attachInterrupt(housekeeping_callback);
+  EthHousekeepingTim->resume();
+#endif
 }
+
+#ifdef ETH_SCHEDULER_TICKLESS
+/**
+* @brief  Time left before a periodic deadline.
+* @param  start: tick of the last run
+* @param  period: period in ms
+* @param  now: current tick
+* @retval time in ms, 0 if the deadline is over
+*/
+static uint32_t TIM_scheduler_Deadline(uint32_t start, uint32_t period, uint32_t now)
+{
+  uint32_t elapsed = now - start;
+
+  return (elapsed >= period) ? 0 : (period - elapsed);
+}
+
+/**
+* @brief  Program the timer for the next scheduler run: next LwIP timeout,
+*         link check or DHCP process, or next ms if the driver is busy.
+*         Earlier runs are forced by stm32_eth_scheduler().
+* @param  None
+* @retval None
+*/
+static void TIM_scheduler_Sleep(void)
+{
+  uint32_t now = HAL_GetTick();
+  uint32_t sleep = ETH_SCHEDULER_MAX_SLEEP;
+  uint32_t next;
+
+  if (ethernetif_work_pending()) {
+    sleep = 1;
+  } else {
+#if NO_SYS
+    /* Otherwise the tcpip thread handles the LwIP timeouts */
+    next = sys_timeouts_sleeptime();
+    if (next < sleep) {
+      sleep = next;
+    }
+#endif
+    next = TIM_scheduler_Deadline(gEhtLinkTickStart, TIME_CHECK_ETH_LINK_STATE, now);
+    if (next < sleep) {
+      sleep = next;
+    }
+#if LWIP_DHCP
+    if ((DHCP_state != DHCP_OFF) && (DHCP_state != DHCP_ADDRESS_ASSIGNED) && (DHCP_state != DHCP_TIMEOUT)) {
+      next = TIM_scheduler_Deadline(DHCPfineTimer, DHCP_FINE_TIMER_MSECS, now);
+      if (next < sleep) {
+        sleep = next;
+      }
+    }
+#endif /* LWIP_DHCP */
+    if (sleep == 0) {
+      sleep = 1;
+    }
+  }
+
+  /* Count from now, the counter could already be above the new period */
+  EthTim->setCount(0);
+  EthTim->setOverflow(sleep * (1000 / ETH_SCHEDULER_TICK_US), TICK_FORMAT);
+#ifdef ETH_SCHEDULER_STATS
+  gEthTickStart = DWT->CYCCNT;
+  gEthTickPeriod = sleep * 1000U * gEthTimingStats.cycles_per_us;
+#endif
+}
+#endif /* ETH_SCHEDULER_TICKLESS */
 #endif
 
 void stm32_eth_init(const uint8_t *mac, const uint8_t *ip, const uint8_t *gw, const uint8_t *netmask)
@@ -204,8 +723,17 @@ void stm32_eth_init(const uint8_t *mac, const uint8_t *ip, const uint8_t *gw, co
   static uint8_t initDone = 0;
 
   if (!initDone) {
+#ifdef ETH_SCHEDULER_STATS
+    stm32_eth_stats_init();
+#endif
+#if NO_SYS
     /* Initialize the LwIP stack */
     lwip_init();
+#else
+    /* Initialize the LwIP stack and start the tcpip thread */
+    tcpip_init(NULL, NULL);
+    gEthSchedMsg = tcpip_callbackmsg_new(stm32_eth_scheduler_msg, NULL);
+#endif
   }
 
   if (mac != NULL) {
@@ -242,18 +770,15 @@ void stm32_eth_init(const uint8_t *mac, const uint8_t *ip, const uint8_t *gw, co
 #endif /* LWIP_DHCP */
   }
 
-  /* Configure the Network interface */
-  Netif_Config();
+  /* Configure the Network interface and reset DHCP if used */
+  stm32_eth_api_call(stm32_eth_netif_config, NULL);
 
   if (!initDone) {
-    // stm32_eth_scheduler() will be called every 1ms.
+    // stm32_eth_scheduler() will be called every ETH_SCHEDULER_PERIOD_US.
     TIM_scheduler_Config();
     initDone = 1;
   }
 
-  /* Reset DHCP if used */
-  User_notification(&gnetif);
-
   /* Update LwIP stack */
   stm32_eth_scheduler();
 }
@@ -297,52 +822,618 @@ uint8_t stm32_eth_link_up(void)
   return netif_is_link_up(&gnetif);
 }
 
-#if defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
 /**
-  * @brief  This function generates Timer Update event to force call to _stm32_eth_scheduler().
-  * @param  None
-  * @retval None
+  * @brief Return Ethernet link speed
+  * @param  None
+  * @retval 10 or 100 (Mb/s), 0 if the link is down
+  */
+uint16_t stm32_eth_link_speed(void)
+{
+  return netif_is_link_up(&gnetif) ? ethernetif_link_speed() : 0;
+}
+
+/**
+  * @brief Return Ethernet link duplex mode
+  * @param  None
+  * @retval 1 for full duplex, 0 for half duplex or link down
+  */
+uint8_t stm32_eth_link_full_duplex(void)
+{
+  return netif_is_link_up(&gnetif) ? ethernetif_link_full_duplex() : 0;
+}
+
+/**
+  * @brief Return the scheduler statistics
+  * @param  None
+  * @retval pointer to the statistics
+  */
+const struct stm32_eth_scheduler_stats *stm32_eth_get_scheduler_stats(void)
+{
+  return &gEthSchedStats;
+}
+
+/**
+  * @brief Return the statistics of the received pbufs held by the TCP
+  *        connections
+  * @param  None
+  * @retval pointer to the statistics
+  */
+const struct stm32_eth_rx_quota_stats *stm32_eth_get_rx_quota_stats(void)
+{
+  return &gEthRxQuotaStats;
+}
+
+#ifdef ETH_SCHEDULER_STATS
+/**
+  * @brief Return the scheduler timing statistics. They are updated by the
+  *        scheduler: copy them with interrupts masked for a consistent view.
+  * @param  None
+  * @retval pointer to the statistics
+  */
+const struct stm32_eth_timing_stats *stm32_eth_get_timing_stats(void)
+{
+  return &gEthTimingStats;
+}
+
+/**
+  * @brief Clear the scheduler timing statistics
+  * @param  None
+  * @retval None
+  */
+void stm32_eth_reset_timing_stats(void)
+{
+  uint32_t primask = __get_PRIMASK();
+  uint32_t cycles_per_us = gEthTimingStats.cycles_per_us;
+
+  __disable_irq();
+  memset(gEthTimingStats.phase, 0, sizeof(gEthTimingStats.phase));
+  gEthTimingStats.isr_max = 0;
+  gEthTimingStats.late_ticks = 0;
+  gEthTimingStats.cycles_per_us = cycles_per_us;
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief Return a percentile of the durations of a scheduler phase
+  * @param  phase: one of stm32_eth_sched_phase
+  * @param  percent: 0 to 100
+  * @retval duration in cycles below which percent of the phase runs ended,
+  *         rounded up to the histogram resolution, 0 if no run recorded
+  */
+uint32_t stm32_eth_timing_percentile(uint8_t phase, uint8_t percent)
+{
+  const struct stm32_eth_phase_stats *stats;
+  uint64_t target;
+  uint64_t sum = 0;
+  uint32_t bound;
+  uint8_t i;
+
+  if ((phase >= ETH_PHASE_NB) || (percent > 100U)) {
+    return 0;
+  }
+  stats = &gEthTimingStats.phase[phase];
+  if (stats->count == 0) {
+    return 0;
+  }
+
+  target = ((uint64_t)stats->count * percent + 99U) / 100U;
+  for (i = 0; i < ETH_STATS_HIST_BUCKETS; i++) {
+    sum += stats->hist[i];
+    if ((sum >= target) && (sum > 0)) {
+      break;
+    }
+  }
+  bound = (i >= 31U) ? 0xFFFFFFFFU : ((2U << i) - 1U);
+  return (bound > stats->max) ? stats->max : bound;
+}
+#endif /* ETH_SCHEDULER_STATS */
+
+#ifdef ETH_HOUSEKEEPING_TIMER
+/**
+  * @brief  End of a LwIP call of the housekeeping tier: run the frame
+  *         processing skipped meanwhile. Its interrupt has a higher priority,
+  *         it preempts the caller as soon as the timer is refreshed.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_core_unlock(void)
+{
+  gEthCoreBusy = 0;
+  if (gEthFastDeferred) {
+    EthTim->refresh();
+  }
+}
+#endif /* ETH_HOUSEKEEPING_TIMER */
+
+/**
+  * @brief  Frame processing: application calls, received and sent frames.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_process_frames(void)
+{
+  ETH_STATS_START(t);
+
+#ifdef ETH_API_USE_QUEUE
+  /* Run the LwIP calls of the application */
+  stm32_eth_api_process();
+  ETH_STATS_PHASE(ETH_PHASE_API, t);
+#endif
+
+  /* Read the received packets from the Ethernet buffers and send them
+  to the lwIP for handling */
+  ethernetif_input(&gnetif);
+  ETH_STATS_PHASE(ETH_PHASE_INPUT, t);
+
+  /* Release the frames sent */
+  ethernetif_tx_process(&gnetif);
+  ETH_STATS_PHASE(ETH_PHASE_TX, t);
+}
+
+/**
+  * @brief  Housekeeping: PHY accesses, link status, LwIP timeouts and DHCP.
+  *         With ETH_HOUSEKEEPING_TIMER, each step using LwIP is marked so
+  *         that the frame processing does not preempt it.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_housekeeping(void)
+{
+#if NO_SYS
+  u32_t sleeptime;
+#endif
+  ETH_STATS_START(t);
+
+  /* Run the PHY register accesses, completions update the netif */
+  ETH_CORE_LOCK();
+  ethernetif_mdio_process();
+  ETH_STATS_PHASE(ETH_PHASE_MDIO, t);
+
+  /* Check ethernet link status */
+  if (ethernetif_link_event() || ((HAL_GetTick() - gEhtLinkTickStart) >= TIME_CHECK_ETH_LINK_STATE)) {
+    ethernetif_set_link(&gnetif);
+    gEhtLinkTickStart = HAL_GetTick();
+  }
+  ETH_STATS_PHASE(ETH_PHASE_LINK, t);
+  ETH_CORE_UNLOCK();
+
+#if NO_SYS
+  /* Handle LwIP timeouts */
+  ETH_CORE_LOCK();
+  sys_check_timeouts();
+  ETH_STATS_PHASE(ETH_PHASE_TIMEOUTS, t);
+  sleeptime = sys_timeouts_sleeptime();
+  ETH_CORE_UNLOCK();
+  gEthNextTimeout = HAL_GetTick() + ((sleeptime > 0x7FFFFFFFU) ? 0x7FFFFFFFU : sleeptime);
+#endif
+
+#if LWIP_DHCP
+  ETH_CORE_LOCK();
+  stm32_DHCP_Periodic_Handle(&gnetif);
+  ETH_STATS_PHASE(ETH_PHASE_DHCP, t);
+  ETH_CORE_UNLOCK();
+#endif /* LWIP_DHCP */
+}
+
+#if defined(STM32_CORE_VERSION) && (STM32_CORE_VERSION  > 0x01060100)
+/**
+  * @brief  Check if the stack needs a scheduler run before the next timer period.
+  * @param  None
+  * @retval 1 if a frame is received or queued, a PHY event or an API call is
+  *         pending or a LwIP timeout is due, 0 otherwise. With
+  *         ETH_HOUSEKEEPING_TIMER, only the frames and API calls are checked.
+  */
+static uint8_t stm32_eth_work_pending(void)
+{
+#ifdef ETH_HOUSEKEEPING_TIMER
+  return ethernetif_work_pending() ||
+         (__atomic_load_n(&gEthApiQueue, __ATOMIC_RELAXED) != NULL);
+#elif NO_SYS
+  return ethernetif_work_pending() || ethernetif_link_event() ||
+         (__atomic_load_n(&gEthApiQueue, __ATOMIC_RELAXED) != NULL) ||
+         ((int32_t)(HAL_GetTick() - gEthNextTimeout) >= 0);
+#else
+  return ethernetif_work_pending() || ethernetif_link_event();
+#endif
+}
+
+/**
+  * @brief  Force a call to _stm32_eth_scheduler() if some work is pending.
+  *         The timer period is shortened so that the run occurs within
+  *         ETH_SCHEDULER_KICK_WINDOW us: following calls before this run
+  *         have no effect. With NO_SYS 0, the run is posted to the tcpip
+  *         thread unless already pending.
+  * @param  None
+  * @retval None
+  */
+void stm32_eth_scheduler(void)
+{
+  if (EthTim == NULL) {
+    return;
+  }
+
+  gEthSchedStats.kicks++;
+  if (!stm32_eth_work_pending()) {
+    gEthSchedStats.kicks_idle++;
+    return;
+  }
+
+#if !NO_SYS
+  if (stm32_eth_post_scheduler()) {
+    gEthSchedStats.forced_runs++;
+  }
+  return;
+#endif
+
+#if ETH_SCHEDULER_KICK_WINDOW > 0
+  uint32_t period = EthTim->getOverflow(MICROSEC_FORMAT);
+  if (period > ETH_SCHEDULER_KICK_WINDOW) {
+    /* Run already due within the window: nothing to do */
+    if ((EthTim->getCount(MICROSEC_FORMAT) + ETH_SCHEDULER_KICK_WINDOW) < period) {
+      gEthKicked = 1;
+      EthTim->setCount(period - ETH_SCHEDULER_KICK_WINDOW, MICROSEC_FORMAT);
+    }
+    return;
+  }
+#endif
+  gEthKicked = 1;
+  EthTim->refresh();
+}
+
+/**
+  * @brief  This function is called solely by Timer callback to avoid race condition.
+  * @param  None
+  * @retval None
+  */
+void _stm32_eth_scheduler(void)
+#else
+/**
+  * @brief  This function is called solely by Timer callback to avoid race condition.
+  * @param  None
+  * @retval None
+  */
+void stm32_eth_scheduler(void)
+#endif
+{
+  ETH_STATS_START(total);
+
+#ifdef ETH_HOUSEKEEPING_TIMER
+  if (gEthCoreBusy) {
+    /* Preempted the housekeeping within LwIP: run when it leaves */
+    gEthFastDeferred = 1;
+    return;
+  }
+  gEthFastDeferred = 0;
+  stm32_eth_process_frames();
+#else
+  stm32_eth_process_frames();
+  stm32_eth_housekeeping();
+#endif
+
+  ETH_STATS_PHASE(ETH_PHASE_TOTAL, total);
+
+#ifdef ETH_SCHEDULER_TICKLESS
+  TIM_scheduler_Sleep();
+#endif
+}
+
+/**
+  * @brief  Wait for a network event (connection, error, DNS answer, DHCP state
+  *         change) or any interrupt, for at most ETH_WAIT_EVENT_SLICE ms.
+  *         Callers must check their condition and timeout again on return.
+  *         Under FreeRTOS, the calling task is blocked until the event is
+  *         signaled, otherwise the CPU sleeps until the next interrupt.
+  * @param  timeout: maximum time to wait in ms
+  * @retval None
+  */
+void stm32_eth_wait_event(uint32_t timeout)
+{
+  if (timeout == 0) {
+    return;
+  }
+  if (timeout > ETH_WAIT_EVENT_SLICE) {
+    timeout = ETH_WAIT_EVENT_SLICE;
+  }
+
+#ifdef ETH_WAIT_USE_FREERTOS
+  if ((__get_IPSR() == 0) && (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)) {
+    gEthWaitTask = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, (pdMS_TO_TICKS(timeout) > 0) ? pdMS_TO_TICKS(timeout) : 1);
+    gEthWaitTask = NULL;
+    return;
+  }
+#endif
+
+  /* Scheduler timer, SysTick or Ethernet interrupt wakes up the CPU */
+  __WFI();
+}
+
+/**
+  * @brief  Wake up the task waiting in stm32_eth_wait_event(), if any.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_signal_event(void)
+{
+#ifdef ETH_WAIT_USE_FREERTOS
+  TaskHandle_t task = gEthWaitTask;
+  BaseType_t woken = pdFALSE;
+
+  if (task != NULL) {
+    if (__get_IPSR() != 0) {
+      vTaskNotifyGiveFromISR(task, &woken);
+      portYIELD_FROM_ISR(woken);
+    } else {
+      xTaskNotifyGive(task);
+    }
+  }
+#endif
+}
+
+#if !NO_SYS
+/* Call forwarded to the tcpip thread by stm32_eth_api_call() */
+struct stm32_eth_api_msg {
+  struct tcpip_api_call_data call;
+  stm32_eth_api_fn fn;
+  void *arg;
+};
+
+/**
+  * @brief  Run the function of a stm32_eth_api_call() in the tcpip thread.
+  * @param  call: call data, first member of struct stm32_eth_api_msg
+  * @retval value returned by the function
+  */
+static err_t stm32_eth_api_handler(struct tcpip_api_call_data *call)
+{
+  struct stm32_eth_api_msg *msg = (struct stm32_eth_api_msg *)call;
+
+  return msg->fn(msg->arg);
+}
+#endif /* !NO_SYS */
+
+#ifdef ETH_API_USE_QUEUE
+/**
+  * @brief  Queue a call for the scheduler. Lock-free: a producer preempted
+  *         by another one retries.
+  * @param  msg: call to queue
+  * @retval None
+  */
+static void stm32_eth_api_push(struct stm32_eth_api_msg *msg)
+{
+#if (__CORTEX_M >= 3U)
+  struct stm32_eth_api_msg *head = __atomic_load_n(&gEthApiQueue, __ATOMIC_RELAXED);
+
+  do {
+    msg->next = head;
+  } while (!__atomic_compare_exchange_n(&gEthApiQueue, &head, msg, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#else
+  /* No exclusive access instructions: mask interrupts for two stores */
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  msg->next = gEthApiQueue;
+  gEthApiQueue = msg;
+  __set_PRIMASK(primask);
+#endif
+}
+
+/**
+  * @brief  Run the queued calls, in their order. Called by the scheduler.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_api_process(void)
+{
+  struct stm32_eth_api_msg *msg;
+  struct stm32_eth_api_msg *next;
+  struct stm32_eth_api_msg *fifo = NULL;
+
+  /* Producers run in thread mode, they can't preempt this interrupt */
+  msg = __atomic_load_n(&gEthApiQueue, __ATOMIC_ACQUIRE);
+  if (msg == NULL) {
+    return;
+  }
+#if (__CORTEX_M >= 3U)
+  msg = __atomic_exchange_n(&gEthApiQueue, NULL, __ATOMIC_ACQUIRE);
+#else
+  gEthApiQueue = NULL;
+#endif
+
+  /* Restore the calls order */
+  while (msg != NULL) {
+    next = msg->next;
+    msg->next = fifo;
+    fifo = msg;
+    msg = next;
+  }
+
+  while (fifo != NULL) {
+    next = fifo->next;
+    fifo->err = fifo->fn(fifo->arg);
+    /* The caller can release the message as soon as done is set */
+    __DMB();
+    fifo->done = 1;
+    fifo = next;
+  }
+}
+
+/**
+  * @brief  Check if BASEPRI masks the scheduler timer interrupt, as in a
+  *         FreeRTOS critical section.
+  * @param  None
+  * @retval 1 if masked, 0 otherwise
+  */
+static uint8_t stm32_eth_api_masked(void)
+{
+#if (__CORTEX_M >= 3U)
+  uint32_t basepri = __get_BASEPRI();
+
+  return (basepri != 0) && ((basepri >> (8U - __NVIC_PRIO_BITS)) <= ETH_TIM_IRQ_PRIO);
+#else
+  return 0;
+#endif
+}
+
+/**
+  * @brief  Check if the current interrupt is a scheduler interrupt, where
+  *         the LwIP calls can run inline.
+  * @param  ipsr: current exception number
+  * @retval 1 if so, 0 otherwise
+  */
+static uint8_t stm32_eth_api_in_scheduler(uint32_t ipsr)
+{
+#ifdef ETH_HOUSEKEEPING_TIMER
+  if (ipsr == gEthHousekeepingIpsr) {
+    return 1;
+  }
+#endif
+  return (ipsr == gEthSchedIpsr);
+}
+
+/**
+  * @brief  Check if the scheduler timer interrupt can preempt the current
+  *         interrupt, so that it can wait for a queued call.
+  * @param  ipsr: current exception number
+  * @retval 1 if so, 0 otherwise
+  */
+static uint8_t stm32_eth_api_preemptible(uint32_t ipsr)
+{
+  /* NMI and HardFault have a fixed priority */
+  if (ipsr < 4U) {
+    return 0;
+  }
+  return (NVIC_GetPriority((IRQn_Type)((int32_t)ipsr - 16)) > ETH_TIM_IRQ_PRIO);
+}
+
+/**
+  * @brief  Force a scheduler interrupt running the queued calls only. The
+  *         calls queued before it is taken are run together.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_api_kick(void)
+{
+  __disable_irq();
+  if (!gEthApiKicked) {
+    gEthApiKicked = 1;
+    /* Restored after the run, see stm32_eth_api_run() */
+    gEthApiResume = EthTim->getCount(TICK_FORMAT);
+    EthTim->refresh();
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief  Run the queued calls without the frame processing and the
+  *         housekeeping, then restore the timer counter saved by
+  *         stm32_eth_api_kick() so that the periodic run keeps its deadline.
+  *         In tickless mode, this run is brought forward if the calls added an
+  *         earlier LwIP timeout.
+  * @param  None
+  * @retval None
+  */
+static void stm32_eth_api_run(void)
+{
+  uint32_t count = gEthApiResume;
+  uint32_t period;
+#ifdef ETH_SCHEDULER_TICKLESS
+  uint32_t next;
+#endif
+
+#ifdef ETH_HOUSEKEEPING_TIMER
+  if (gEthCoreBusy) {
+    /* Preempted the housekeeping within LwIP: run when it leaves */
+    gEthFastDeferred = 1;
+    return;
+  }
+#endif
+
+  ETH_STATS_START(t);
+  stm32_eth_api_process();
+  ETH_STATS_PHASE(ETH_PHASE_API, t);
+
+  if (gEthKicked && (EthTim->getCount(TICK_FORMAT) > count)) {
+    /* Run brought forward by stm32_eth_scheduler() meanwhile */
+    count = EthTim->getCount(TICK_FORMAT);
+  }
+  period = EthTim->getOverflow(TICK_FORMAT);
+#ifdef ETH_SCHEDULER_TICKLESS
+  next = sys_timeouts_sleeptime();
+  if ((count < period) && (next < ((period - count) / (1000U / ETH_SCHEDULER_TICK_US)))) {
+    count = period - ((next > 0) ? (next * (1000U / ETH_SCHEDULER_TICK_US)) : 1U);
+  }
+#endif
+  if (count >= period) {
+    count = period - 1U;
+  }
+  EthTim->setCount(count, TICK_FORMAT);
+}
+#endif /* ETH_API_USE_QUEUE */
+
+/**
+  * @brief  Call a function using the LwIP raw API from the application.
+  *         With NO_SYS 1, it is queued and run by a scheduler interrupt
+  *         forced for the queued calls only, while the caller sleeps. It runs
+  *         inline from the scheduler interrupts (LwIP callbacks) and from
+  *         thread mode with this interrupt masked. An interrupt the scheduler
+  *         can't preempt may have preempted it within LwIP: the call is
+  *         refused. Otherwise it runs in the tcpip thread (or with the LwIP
+  *         core locked) and the caller waits for its completion.
+  * @param  fn: function to call
+  * @param  arg: argument passed to fn
+  * @retval value returned by fn, ERR_WOULDBLOCK if refused
   */
-void stm32_eth_scheduler(void)
+err_t stm32_eth_api_call(stm32_eth_api_fn fn, void *arg)
 {
-  if (EthTim != NULL) {
-    EthTim->refresh();
+#if NO_SYS
+#ifdef ETH_API_USE_QUEUE
+  struct stm32_eth_api_msg msg;
+  uint32_t ipsr = __get_IPSR();
+
+  if ((EthTim == NULL) || ((ipsr != 0) && stm32_eth_api_in_scheduler(ipsr))) {
+    /* Scheduler not started, or LwIP context */
+    return fn(arg);
   }
-}
-
-/**
-  * @brief  This function is called solely by Timer callback to avoid race condition.
-  * @param  None
-  * @retval None
-  */
-void _stm32_eth_scheduler(void)
+  if ((__get_PRIMASK() != 0) || stm32_eth_api_masked() ||
+      ((ipsr != 0) && !stm32_eth_api_preemptible(ipsr))) {
+    /* The scheduler interrupt can't run: only thread mode can't have
+       preempted it */
+    if (ipsr == 0) {
+      return fn(arg);
+    }
+    return ERR_WOULDBLOCK;
+  }
+  msg.fn = fn;
+  msg.arg = arg;
+  msg.err = ERR_OK;
+  msg.done = 0;
+  stm32_eth_api_push(&msg);
+  stm32_eth_api_kick();
+
+  while (!msg.done) {
+    /* A pending interrupt wakes up the CPU even if masked: no lost wake-up */
+    __disable_irq();
+    if (!msg.done) {
+      __WFI();
+    }
+    __enable_irq();
+  }
+  return msg.err;
 #else
-/**
-  * @brief  This function is called solely by Timer callback to avoid race condition.
-  * @param  None
-  * @retval None
-  */
-void stm32_eth_scheduler(void)
+  return fn(arg);
 #endif
-{
-  /* Read a received packet from the Ethernet buffers and send it
-  to the lwIP for handling */
-#ifndef ETH_INPUT_USE_IT
-  ethernetif_input(&gnetif);
-#endif /* ETH_INPUT_USE_IT */
+#else
+  struct stm32_eth_api_msg msg = {};
 
-  /* Check ethernet link status */
-  if ((HAL_GetTick() - gEhtLinkTickStart) >= TIME_CHECK_ETH_LINK_STATE) {
-    ethernetif_set_link(&gnetif);
-    gEhtLinkTickStart = HAL_GetTick();
+  if (gEthSchedMsg == NULL) {
+    /* tcpip thread not started */
+    return fn(arg);
   }
-
-  /* Handle LwIP timeouts */
-  sys_check_timeouts();
-
-#if LWIP_DHCP
-  stm32_DHCP_Periodic_Handle(&gnetif);
-#endif /* LWIP_DHCP */
+  msg.fn = fn;
+  msg.arg = arg;
+  return tcpip_api_call(stm32_eth_api_handler, &msg.call);
+#endif
 }
 
 #if LWIP_DHCP
@@ -365,6 +1456,7 @@ uint8_t stm32_dhcp_started(void)
 void stm32_DHCP_process(struct netif *netif)
 {
   struct dhcp *dhcp;
+  uint8_t state = DHCP_state;
 
   if (netif_is_link_up(netif)) {
     switch (DHCP_state) {
@@ -415,6 +1507,10 @@ void stm32_DHCP_process(struct netif *netif)
   } else {
     DHCP_state = DHCP_OFF;
   }
+
+  if (DHCP_state != state) {
+    stm32_eth_signal_event();
+  }
 }
 
 /**
@@ -432,6 +1528,18 @@ void stm32_DHCP_Periodic_Handle(struct netif *netif)
   }
 }
 
+/**
+  * @brief  Call dhcp_inform(), through stm32_eth_api_call()
+  * @param  arg: unused
+  * @retval ERR_OK
+  */
+static err_t stm32_DHCP_inform(void *arg)
+{
+  UNUSED(arg);
+  dhcp_inform(&gnetif);
+  return ERR_OK;
+}
+
 /**
   * @brief  Inform the local DHCP of our manual IP configuration
   * @param  None
@@ -439,7 +1547,7 @@ void stm32_DHCP_Periodic_Handle(struct netif *netif)
   */
 void stm32_DHCP_manual_config(void)
 {
-  dhcp_inform(&gnetif);
+  stm32_eth_api_call(stm32_DHCP_inform, NULL);
 }
 
 /**
@@ -591,6 +1699,18 @@ void User_notification(struct netif *netif)
 
 #if LWIP_DNS
 
+/**
+  * @brief  Initializes DNS with a server address, through stm32_eth_api_call()
+  * @param  arg: pointer to the DNS server address (ip_addr_t)
+  * @retval ERR_OK
+  */
+static err_t stm32_dns_setserver(void *arg)
+{
+  dns_init();
+  dns_setserver(0, (const ip_addr_t *)arg);
+  return ERR_OK;
+}
+
 /**
   * @brief  Initializes DNS
   * @param  dnsaddr: DNS address
@@ -602,9 +1722,8 @@ void stm32_dns_init(const uint8_t *dnsaddr)
 
   /* DNS initialized by DHCP when call dhcp_start() */
   if (!stm32_dhcp_started()) {
-    dns_init();
     IP_ADDR4(&ip, dnsaddr[0], dnsaddr[1], dnsaddr[2], dnsaddr[3]);
-    dns_setserver(0, &ip);
+    stm32_eth_api_call(stm32_dns_setserver, &ip);
   }
 }
 
@@ -624,6 +1743,26 @@ void dns_callback(const char *name, const ip_addr_t *ipaddr, void *callback_arg)
   } else {
     *((uint32_t *)callback_arg) = 0;
   }
+  stm32_eth_signal_event();
+}
+
+/* Arguments of stm32_dns_request() */
+struct stm32_dns_args {
+  const char *hostname;
+  ip_addr_t iphost;
+  uint32_t *ipaddr;
+};
+
+/**
+  * @brief  Call dns_gethostbyname(), through stm32_eth_api_call()
+  * @param  arg: pointer to struct stm32_dns_args
+  * @retval value returned by dns_gethostbyname()
+  */
+static err_t stm32_dns_request(void *arg)
+{
+  struct stm32_dns_args *args = (struct stm32_dns_args *)arg;
+
+  return dns_gethostbyname(args->hostname, &args->iphost, &dns_callback, args->ipaddr);
 }
 
 /**
@@ -635,188 +1774,721 @@ void dns_callback(const char *name, const ip_addr_t *ipaddr, void *callback_arg)
  */
 int8_t stm32_dns_gethostbyname(const char *hostname, uint32_t *ipaddr)
 {
-  ip_addr_t iphost;
+  struct stm32_dns_args args;
   err_t err;
   uint32_t tickstart = 0;
   int8_t ret = 0;
 
   *ipaddr = 0;
-  err = dns_gethostbyname(hostname, &iphost, &dns_callback, ipaddr);
+  args.hostname = hostname;
+  args.ipaddr = ipaddr;
+  err = stm32_eth_api_call(stm32_dns_request, &args);
 
   switch (err) {
     case ERR_OK:
-      *ipaddr = ip4_addr_get_u32(&iphost);
+      *ipaddr = ip4_addr_get_u32(&args.iphost);
       ret = 1;
       break;
 
     case ERR_INPROGRESS:
       tickstart = HAL_GetTick();
-      while (*ipaddr == 0) {
-        stm32_eth_scheduler();
+      stm32_eth_scheduler();
+      while (*(volatile uint32_t *)ipaddr == 0) {
         if ((HAL_GetTick() - tickstart) >= TIMEOUT_DNS_REQUEST) {
           ret = -1;
           break;
         }
+        stm32_eth_wait_event(TIMEOUT_DNS_REQUEST - (HAL_GetTick() - tickstart));
+      }
+
+      if (ret == 0) {
+        if (*ipaddr == 0) {
+          ret = -2;
+        } else {
+          ret = 1;
+        }
+      }
+      break;
+
+    case ERR_ARG:
+      ret = -4;
+      break;
+
+    default:
+      ret = -4;
+      break;
+  }
+
+  return ret;
+}
+
+#endif /* LWIP_DNS */
+
+/**
+  * @brief  Converts a uint8_t IP address to a ip_addr_t address
+  * @param  ipu8: pointer to an address to convert
+  * @param  ipaddr: pointer where store the address converted
+  * @retval pointer to an address in ip_addr_t format
+  */
+ip_addr_t *u8_to_ip_addr(uint8_t *ipu8, ip_addr_t *ipaddr)
+{
+  IP_ADDR4(ipaddr, ipu8[0], ipu8[1], ipu8[2], ipu8[3]);
+  return ipaddr;
+}
+
+/**
+  * @brief  Converts a ip_addr_t IP address to a uint32_t address
+  * @param  ipaddr: pointer to an address to convert
+  * @retval pointer to the address converted
+  */
+uint32_t ip_addr_to_u32(ip_addr_t *ipaddr)
+{
+  return ip4_addr_get_u32(ipaddr);
+}
+
+/**
+  * @brief  Allocate a pbuf with data pass in parameter
+  * @param  p: pointer to pbuf
+  * @param  buffer: pointer to data to store
+  * @param  size: number of data to store
+  * @retval pointer to the pbuf allocated
+  */
+struct pbuf *stm32_new_data(struct pbuf *p, const uint8_t *buffer, size_t size)
+{
+  // Allocate memory if pbuf doesn't exit yet.
+  if (p == NULL) {
+    p = pbuf_alloc(PBUF_TRANSPORT, size, PBUF_RAM);
+
+    if (p != NULL) {
+      // Copy data inside pbuf
+      if (ERR_OK == pbuf_take(p, (uint8_t *)buffer, size)) {
+        return p;
+      } else {
+        pbuf_free(p);
+      }
+    }
+  }
+  // If pbuf allocated, grow the size of pbuf and add new data
+  // NOTE: pbuf_realloc can't be used to grow the size of pbuf
+  else {
+    struct pbuf *q = pbuf_alloc(PBUF_TRANSPORT, size + p->tot_len, PBUF_RAM);
+
+    if (q != NULL) {
+      if (ERR_OK == pbuf_copy(q, p)) {
+        if (ERR_OK == pbuf_take_at(q, (uint8_t *)buffer, size, p->tot_len)) {
+          pbuf_free(p);
+          p = q;
+          return p;
+        }
       }
 
-      if (ret == 0) {
-        if (*ipaddr == 0) {
-          ret = -2;
-        } else {
-          ret = 1;
-        }
-      }
-      break;
+      pbuf_free(q);
+    }
+  }
+
+  return 0;
+}
+
+/**
+  * @brief  Free pbuf
+  * @param  p: pointer to pbuf
+  * @retval return always NULL
+  */
+struct pbuf *stm32_free_data(struct pbuf *p)
+{
+  uint16_t n;
+
+  if (p != NULL) {
+    do {
+      n = pbuf_free(p);
+    } while (n == 0);
+  }
+
+  return NULL;
+}
+
+/**
+  * @brief Move to the next pbuf of the chain, releasing the current one
+  * @param data pointer to data structure
+  * @retval None
+  */
+static void next_data(struct pbuf_data *data)
+{
+  struct pbuf *ptr = data->p;
+
+  data->p = ptr->next;
+  if (data->p != NULL) {
+    /* increment reference count for p */
+    pbuf_ref(data->p);
+  }
+  /* chop first pbuf from chain */
+  stm32_free_data(ptr);
+  data->offset = 0;
+}
+
+/**
+  * @brief This function passes pbuf data to uin8_t buffer. It takes account if
+  * pbuf is chained: each pbuf is copied at once.
+  * @param data pointer to data structure
+  * @param buffer the buffer where write the data read, NULL to drop the data
+  * @param size the number of data to read
+  * @retval number of data read
+  */
+static uint32_t get_data(struct pbuf_data *data, uint8_t *buffer, size_t size)
+{
+  uint32_t nb = 0;
+  uint32_t len;
+
+  if ((data->p == NULL) || (size == 0)) {
+    return 0;
+  }
+
+  while ((nb < size) && (data->p != NULL) && (data->available > 0)) {
+    len = data->p->len - data->offset;
+    if (len > (size - nb)) {
+      len = size - nb;
+    }
+    if (len > data->available) {
+      len = data->available;
+    }
+
+    if (buffer != NULL) {
+      memcpy(&buffer[nb], (uint8_t *)data->p->payload + data->offset, len);
+    }
+    nb += len;
+    data->offset += len;
+    data->available -= len;
+
+    if (data->offset >= data->p->len) {
+      /* continue with next pbuf in chain (if any) */
+      next_data(data);
+    }
+  }
+
+  if (data->available == 0) {
+    data->p = stm32_free_data(data->p);
+    data->offset = 0;
+  }
+
+  return nb;
+}
+
+/* Arguments of stm32_get_data_call() */
+struct stm32_get_data_args {
+  struct pbuf_data *data;
+  uint8_t *buffer;
+  size_t size;
+  uint32_t nb;
+  struct tcp_struct *tcp;   /* connection to reopen the window of, NULL for UDP */
+};
+
+#if LWIP_TCP
+/**
+  * @brief Count the pool pbufs of a pbuf chain: the pbufs copied to the heap
+  * and the zero-copy receive buffers are not taken from the pool
+  * @param p pbuf chain
+  * @retval number of PBUF_POOL pbufs
+  */
+static uint16_t tcp_rx_clen(const struct pbuf *p)
+{
+  uint16_t n = 0;
+
+  for (; p != NULL; p = p->next) {
+    if (pbuf_get_allocsrc(p) == PBUF_TYPE_ALLOC_SRC_MASK_STD_MEMP_PBUF_POOL) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/**
+  * @brief Count the zero-copy receive buffers of a pbuf chain, the only
+  * custom pbufs received
+  * @param p pbuf chain
+  * @retval number of spare receive buffers held
+  */
+static uint16_t tcp_rx_spares(const struct pbuf *p)
+{
+  uint16_t n = 0;
+
+#ifdef ETH_RX_ZERO_COPY
+  for (; p != NULL; p = p->next) {
+    if (p->flags & PBUF_FLAG_IS_CUSTOM) {
+      n++;
+    }
+  }
+#else
+  UNUSED(p);
+#endif
+  return n;
+}
+
+#ifdef ETH_RX_ZERO_COPY
+/**
+  * @brief Copy a received segment holding spare receive buffers to pool
+  * pbufs when the connection already holds ETH_TCP_RX_SPARE_QUOTA of them
+  * @param tcp pointer to the TCP connection
+  * @param p received segment
+  * @retval the copy, or p if it is kept
+  */
+static struct pbuf *tcp_rx_spare_limit(struct tcp_struct *tcp, struct pbuf *p)
+{
+  uint16_t n = tcp_rx_spares(p);
+  struct pbuf *q;
+
+  if ((n == 0) || ((tcp->rx_spares + n) <= ETH_TCP_RX_SPARE_QUOTA)) {
+    return p;
+  }
+  q = pbuf_clone(PBUF_RAW, PBUF_POOL, p);
+  if (q == NULL) {
+    return p;
+  }
+  pbuf_free(p);
+  gEthRxQuotaStats.spares_copied++;
+  return q;
+}
+#endif /* ETH_RX_ZERO_COPY */
+
+#if ETH_RX_COMPACT_SIZE > 0
+/**
+  * @brief Copy a small received segment to the heap when the receive buffers
+  * run short, so that its buffer is released at once
+  * @param p received segment
+  * @retval the copy, or p if it is kept
+  */
+static struct pbuf *tcp_rx_compact(struct pbuf *p)
+{
+  struct pbuf *q;
+
+  if ((p->tot_len > ETH_RX_COMPACT_SIZE) ||
+      (gEthRxQuotaStats.held < ETH_RX_COMPACT_THRESHOLD) ||
+      (tcp_rx_clen(p) == 0)) {
+    return p;
+  }
+  q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+  if (q == NULL) {
+    return p;
+  }
+  if (pbuf_copy(q, p) != ERR_OK) {
+    pbuf_free(q);
+    return p;
+  }
+  pbuf_free(p);
+  gEthRxQuotaStats.compacted++;
+  return q;
+}
+#endif /* ETH_RX_COMPACT_SIZE > 0 */
+
+/**
+  * @brief Account received pbufs to a connection if its quotas allow it
+  * @param tcp pointer to the TCP connection
+  * @param n number of pbufs
+  * @retval 1 if accounted, 0 if the data must be refused
+  */
+static uint8_t tcp_rx_quota_take(struct tcp_struct *tcp, uint16_t n)
+{
+  struct tcp_struct *server = tcp->server;
+
+  if (n == 0) {
+    return 1;
+  }
+  /* A connection holding nothing always gets its data, so it can progress */
+  if (tcp->rx_pbufs > 0) {
+    if ((tcp->rx_pbufs + n) > ETH_TCP_RX_PBUF_QUOTA) {
+      gEthRxQuotaStats.conn_quota_hits++;
+      return 0;
+    }
+    if ((server != NULL) && ((server->rx_pbufs + n) > ETH_SERVER_RX_PBUF_QUOTA)) {
+      gEthRxQuotaStats.server_quota_hits++;
+      return 0;
+    }
+    if ((gEthRxQuotaStats.held + n) > (PBUF_POOL_SIZE - ETH_RX_POOL_RESERVE)) {
+      gEthRxQuotaStats.reserve_hits++;
+      return 0;
+    }
+  }
+
+  tcp->rx_pbufs += n;
+  if (server != NULL) {
+    server->rx_pbufs += n;
+  }
+  gEthRxQuotaStats.held += n;
+  if (gEthRxQuotaStats.held > gEthRxQuotaStats.held_max) {
+    gEthRxQuotaStats.held_max = gEthRxQuotaStats.held;
+  }
+  return 1;
+}
+
+/**
+  * @brief Release the pbufs a connection no longer holds, then deliver the
+  * data refused meanwhile
+  * @param tcp pointer to the TCP connection
+  * @retval None
+  */
+static void tcp_rx_quota_update(struct tcp_struct *tcp)
+{
+  uint16_t held = tcp_rx_spares(tcp->data.p);
+  uint16_t n;
 
-    case ERR_ARG:
-      ret = -4;
-      break;
+  if (held < tcp->rx_spares) {
+    gEthRxQuotaStats.spares_held -= tcp->rx_spares - held;
+    tcp->rx_spares = held;
+  }
 
-    default:
-      ret = -4;
-      break;
+  held = tcp_rx_clen(tcp->data.p);
+  if (held >= tcp->rx_pbufs) {
+    return;
+  }
+  n = tcp->rx_pbufs - held;
+  tcp->rx_pbufs = held;
+  if (tcp->server != NULL) {
+    tcp->server->rx_pbufs -= n;
   }
+  gEthRxQuotaStats.held -= n;
 
-  return ret;
+  if ((tcp->pcb != NULL) && (tcp->pcb->refused_data != NULL)) {
+    tcp_process_refused_data(tcp->pcb);
+  }
 }
 
-#endif /* LWIP_DNS */
-
 /**
-  * @brief  Converts a uint8_t IP address to a ip_addr_t address
-  * @param  ipu8: pointer to an address to convert
-  * @param  ipaddr: pointer where store the address converted
-  * @retval pointer to an address in ip_addr_t format
+  * @brief Reopen the receive window of the data read by the application,
+  * except what is withheld to apply ETH_TCP_RX_CAP
+  * @param tcp pointer to the TCP connection
+  * @param len number of data read
+  * @retval None
   */
-ip_addr_t *u8_to_ip_addr(uint8_t *ipu8, ip_addr_t *ipaddr)
+static void tcp_data_read(struct tcp_struct *tcp, uint32_t len)
 {
-  IP_ADDR4(ipaddr, ipu8[0], ipu8[1], ipu8[2], ipu8[3]);
-  return ipaddr;
+  uint32_t withheld = (len < tcp->rx_withheld) ? len : tcp->rx_withheld;
+  uint16_t n;
+
+  tcp->rx_withheld -= withheld;
+  len -= withheld;
+  if (tcp->pcb != NULL) {
+    while (len > 0) {
+      n = (len > 0xFFFFU) ? 0xFFFFU : len;
+      tcp_recved(tcp->pcb, n);
+      len -= n;
+    }
+  }
+  tcp_rx_quota_update(tcp);
 }
+#endif /* LWIP_TCP */
 
 /**
-  * @brief  Converts a ip_addr_t IP address to a uint32_t address
-  * @param  ipaddr: pointer to an address to convert
-  * @retval pointer to the address converted
+  * @brief Call get_data(), through stm32_eth_api_call()
+  * @param arg pointer to struct stm32_get_data_args
+  * @retval ERR_OK
   */
-uint32_t ip_addr_to_u32(ip_addr_t *ipaddr)
+static err_t stm32_get_data_call(void *arg)
 {
-  return ip4_addr_get_u32(ipaddr);
+  struct stm32_get_data_args *args = (struct stm32_get_data_args *)arg;
+
+  args->nb = get_data(args->data, args->buffer, args->size);
+#if LWIP_TCP
+  if (args->tcp != NULL) {
+    tcp_data_read(args->tcp, args->nb);
+  }
+#endif
+  return ERR_OK;
 }
 
 /**
-  * @brief  Allocate a pbuf with data pass in parameter
-  * @param  p: pointer to pbuf
-  * @param  buffer: pointer to data to store
-  * @param  size: number of data to store
-  * @retval pointer to the pbuf allocated
+  * @brief This function passes pbuf data to uin8_t buffer. The receive
+  * callbacks append data to the same chain, so it runs in the LwIP context.
+  * @param data pointer to data structure
+  * @param buffer the buffer where write the data read
+  * @param size the number of data to read
+  * @retval number of data read
   */
-struct pbuf *stm32_new_data(struct pbuf *p, const uint8_t *buffer, size_t size)
+uint32_t stm32_get_data(struct pbuf_data *data, uint8_t *buffer, size_t size)
 {
-  // Allocate memory if pbuf doesn't exit yet.
-  if (p == NULL) {
-    p = pbuf_alloc(PBUF_TRANSPORT, size, PBUF_RAM);
+  struct stm32_get_data_args args = {data, buffer, size, 0, NULL};
 
-    if (p != NULL) {
-      // Copy data inside pbuf
-      if (ERR_OK == pbuf_take(p, (uint8_t *)buffer, size)) {
-        return p;
-      } else {
-        pbuf_free(p);
-      }
-    }
+  if (buffer == NULL) {
+    return 0;
   }
-  // If pbuf allocated, grow the size of pbuf and add new data
-  // NOTE: pbuf_realloc can't be used to grow the size of pbuf
-  else {
-    struct pbuf *q = pbuf_alloc(PBUF_TRANSPORT, size + p->tot_len, PBUF_RAM);
+  stm32_eth_api_call(stm32_get_data_call, &args);
+  return args.nb;
+}
 
-    if (q != NULL) {
-      if (ERR_OK == pbuf_copy(q, p)) {
-        if (ERR_OK == pbuf_take_at(q, (uint8_t *)buffer, size, p->tot_len)) {
-          pbuf_free(p);
-          p = q;
-          return p;
-        }
-      }
+/* Arguments of stm32_borrow_data_call() */
+struct stm32_borrow_data_args {
+  struct pbuf_data *data;
+  uint32_t skip;
+  const uint8_t *span;
+  uint32_t len;
+};
 
-      pbuf_free(q);
+/**
+  * @brief Return the next contiguous span of pbuf data, through
+  * stm32_eth_api_call()
+  * @param arg pointer to struct stm32_borrow_data_args
+  * @retval ERR_OK
+  */
+static err_t stm32_borrow_data_call(void *arg)
+{
+  struct stm32_borrow_data_args *args = (struct stm32_borrow_data_args *)arg;
+  struct pbuf_data *data = args->data;
+  struct pbuf *q;
+  uint32_t offset;
+
+  /* Skip the pbufs fully read or empty */
+  while ((data->p != NULL) && (data->available > 0) && (data->offset >= data->p->len)) {
+    next_data(data);
+  }
+  if ((data->p == NULL) || (data->available <= args->skip)) {
+    return ERR_OK;
+  }
+  q = data->p;
+  offset = data->offset + args->skip;
+  while ((q != NULL) && (offset >= q->len)) {
+    offset -= q->len;
+    q = q->next;
+  }
+  if (q != NULL) {
+    args->span = (const uint8_t *)q->payload + offset;
+    args->len = q->len - offset;
+    if (args->len > (data->available - args->skip)) {
+      args->len = data->available - args->skip;
     }
   }
-
-  return 0;
+  return ERR_OK;
 }
 
 /**
-  * @brief  Free pbuf
-  * @param  p: pointer to pbuf
-  * @retval return always NULL
+  * @brief Give access to the next contiguous span of pbuf data without
+  * copying it. It stays valid until released by stm32_commit_data(). Only the
+  * data appended to the chain (TCP) can be borrowed: a new UDP datagram
+  * replaces the previous one.
+  * @param data pointer to data structure
+  * @param skip number of bytes already borrowed, not returned again
+  * @param span set to the first byte of the span
+  * @retval number of bytes in the span, 0 if no data available
   */
-struct pbuf *stm32_free_data(struct pbuf *p)
+uint32_t stm32_borrow_data(struct pbuf_data *data, uint32_t skip, const uint8_t **span)
 {
-  uint16_t n;
-
-  if (p != NULL) {
-    do {
-      n = pbuf_free(p);
-    } while (n == 0);
-  }
+  struct stm32_borrow_data_args args = {data, skip, NULL, 0};
 
-  return NULL;
+  stm32_eth_api_call(stm32_borrow_data_call, &args);
+  *span = args.span;
+  return args.len;
 }
 
 /**
-  * @brief This function passes pbuf data to uin8_t buffer. It takes account if
-  * pbuf is chained.
+  * @brief Consume pbuf data read through stm32_borrow_data()
   * @param data pointer to data structure
+  * @param size the number of data consumed
+  * @retval number of data consumed
+  */
+uint32_t stm32_commit_data(struct pbuf_data *data, size_t size)
+{
+  struct stm32_get_data_args args = {data, NULL, size, 0, NULL};
+
+  stm32_eth_api_call(stm32_get_data_call, &args);
+  return args.nb;
+}
+
+#if LWIP_TCP
+/**
+  * @brief Same as stm32_get_data() for the data of a TCP connection: the
+  * receive window is reopened by the data read.
+  * @param tcp pointer to the TCP connection
   * @param buffer the buffer where write the data read
   * @param size the number of data to read
   * @retval number of data read
   */
-uint16_t stm32_get_data(struct pbuf_data *data, uint8_t *buffer, size_t size)
+uint32_t stm32_tcp_get_data(struct tcp_struct *tcp, uint8_t *buffer, size_t size)
 {
-  uint16_t i;
-  uint16_t offset;
-  uint16_t nb;
-  struct pbuf *ptr;
+  struct stm32_get_data_args args = {&tcp->data, buffer, size, 0, tcp};
 
-  if ((data->p == NULL) || (buffer == NULL) || (size == 0) ||
-      (data->available == 0) || (data->available > data->p->tot_len)) {
+  if (buffer == NULL) {
     return 0;
   }
+  stm32_eth_api_call(stm32_get_data_call, &args);
+  return args.nb;
+}
 
-  nb = 0;
+/**
+  * @brief Same as stm32_commit_data() for the data of a TCP connection: the
+  * receive window is reopened by the data consumed.
+  * @param tcp pointer to the TCP connection
+  * @param size the number of data consumed
+  * @retval number of data consumed
+  */
+uint32_t stm32_tcp_commit_data(struct tcp_struct *tcp, size_t size)
+{
+  struct stm32_get_data_args args = {&tcp->data, NULL, size, 0, tcp};
 
-  while ((nb < size) && (data->p != NULL) && (data->available > 0)) {
-    ptr = data->p;
-    offset = ptr->tot_len - data->available;
-
-    /* Get data from p */
-    for (i = 0; (nb < size) && ((offset + i) < ptr->len) && (data->available > 0); i++) {
-      buffer[nb] = pbuf_get_at(ptr, offset + i);
-      nb++;
-      data->available--;
-    }
+  stm32_eth_api_call(stm32_get_data_call, &args);
+  return args.nb;
+}
+#endif /* LWIP_TCP */
 
-    if (nb < size) {
-      /* continue with next pbuf in chain (if any) */
-      data->p = ptr->next;
+/* Arguments of stm32_peek_data_call() */
+struct stm32_peek_data_args {
+  struct pbuf_data *data;
+  uint32_t skip;
+  int b;
+};
 
-      if (data->p != NULL) {
-        /* increment reference count for p */
-        pbuf_ref(data->p);
-      }
+/**
+  * @brief Read the next byte of pbuf data, through stm32_eth_api_call()
+  * @param arg pointer to struct stm32_peek_data_args
+  * @retval ERR_OK
+  */
+static err_t stm32_peek_data_call(void *arg)
+{
+  struct stm32_peek_data_args *args = (struct stm32_peek_data_args *)arg;
+  struct pbuf_data *data = args->data;
+  struct pbuf *q = data->p;
+  uint32_t offset = data->offset + args->skip;
+
+  if (data->available <= args->skip) {
+    return ERR_OK;
+  }
+  while ((q != NULL) && (offset >= q->len)) {
+    offset -= q->len;
+    q = q->next;
+  }
+  if (q != NULL) {
+    args->b = ((uint8_t *)q->payload)[offset];
+  }
+  return ERR_OK;
+}
+
+/**
+  * @brief Return the next byte of pbuf data without consuming it.
+  * @param data pointer to data structure
+  * @param skip number of bytes already borrowed, not returned again
+  * @retval next byte, -1 if no data available
+  */
+int stm32_peek_data(struct pbuf_data *data, uint32_t skip)
+{
+  struct stm32_peek_data_args args = {data, skip, -1};
+
+  stm32_eth_api_call(stm32_peek_data_call, &args);
+  return args.b;
+}
+
+/* Arguments of stm32_find_data_call() and stm32_match_data_call() */
+struct stm32_find_data_args {
+  struct pbuf_data *data;
+  const uint8_t *s;
+  uint32_t len;
+  int32_t ret;
+};
 
-      /* chop first pbuf from chain */
-      ptr = stm32_free_data(ptr);
+/**
+  * @brief Search a byte in pbuf data with memchr(), through
+  * stm32_eth_api_call()
+  * @param arg pointer to struct stm32_find_data_args, s points to the byte
+  * @retval ERR_OK
+  */
+static err_t stm32_find_data_call(void *arg)
+{
+  struct stm32_find_data_args *args = (struct stm32_find_data_args *)arg;
+  struct pbuf_data *data = args->data;
+  struct pbuf *q = data->p;
+  uint32_t offset = data->offset;
+  uint32_t left = (args->len < data->available) ? args->len : data->available;
+  uint32_t pos = 0;
+  uint32_t len;
+  const uint8_t *found;
+
+  while ((q != NULL) && (left > 0)) {
+    if (offset < q->len) {
+      len = q->len - offset;
+      if (len > left) {
+        len = left;
+      }
+      found = (const uint8_t *)memchr((uint8_t *)q->payload + offset, *args->s, len);
+      if (found != NULL) {
+        args->ret = pos + (found - ((uint8_t *)q->payload + offset));
+        return ERR_OK;
+      }
+      pos += len;
+      left -= len;
     }
+    offset = 0;
+    q = q->next;
   }
+  return ERR_OK;
+}
 
-  if (data->available == 0) {
-    data->p = stm32_free_data(data->p);
+/**
+  * @brief Search a byte in pbuf data without consuming it.
+  * @param data pointer to data structure
+  * @param c the byte to search
+  * @param max the number of data to search in
+  * @retval position of the byte from the next one to read, -1 if not found
+  */
+int32_t stm32_find_data(struct pbuf_data *data, uint8_t c, uint32_t max)
+{
+  struct stm32_find_data_args args = {data, &c, max, -1};
+
+  if (data->p == NULL) {
+    return -1;
   }
+  stm32_eth_api_call(stm32_find_data_call, &args);
+  return args.ret;
+}
 
-  return nb;
+/**
+  * @brief Compare pbuf data with a byte string, through stm32_eth_api_call()
+  * @param arg pointer to struct stm32_find_data_args
+  * @retval ERR_OK
+  */
+static err_t stm32_match_data_call(void *arg)
+{
+  struct stm32_find_data_args *args = (struct stm32_find_data_args *)arg;
+  struct pbuf_data *data = args->data;
+  struct pbuf *q = data->p;
+  uint32_t offset = data->offset;
+  uint32_t done = 0;
+  uint32_t len;
+
+  if (data->available < args->len) {
+    /* Compare what is available, the rest is not received yet */
+    args->len = data->available;
+    args->ret = -1;
+  } else {
+    args->ret = 1;
+  }
+  while ((q != NULL) && (done < args->len)) {
+    if (offset < q->len) {
+      len = q->len - offset;
+      if (len > (args->len - done)) {
+        len = args->len - done;
+      }
+      if (memcmp((uint8_t *)q->payload + offset, &args->s[done], len) != 0) {
+        args->ret = 0;
+        return ERR_OK;
+      }
+      done += len;
+    }
+    offset = 0;
+    q = q->next;
+  }
+  return ERR_OK;
+}
+
+/**
+  * @brief Compare the next bytes of pbuf data with a byte string without
+  * consuming them.
+  * @param data pointer to data structure
+  * @param s the byte string
+  * @param len the length of s
+  * @retval 1 if they match, 0 if not, -1 if the data available match but are
+  *         shorter than s
+  */
+int8_t stm32_match_data(struct pbuf_data *data, const uint8_t *s, size_t len)
+{
+  struct stm32_find_data_args args = {data, s, (uint32_t)len, -1};
+
+  stm32_eth_api_call(stm32_match_data_call, &args);
+  return args.ret;
 }
 
 #if LWIP_UDP
@@ -844,7 +2516,8 @@ void udp_receive_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
     }
 
     udp_arg->data.p = p;
-    udp_arg->data.available = p->len;
+    udp_arg->data.available = p->tot_len;
+    udp_arg->data.offset = 0;
 
     ip_addr_copy(udp_arg->ip, *addr);
     udp_arg->port = port;
@@ -861,6 +2534,54 @@ void udp_receive_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p,
 
 #if LWIP_TCP
 
+static void tcp_connect_timeout(void *arg);
+
+/**
+  * @brief End of a connection attempt: stop its timeout and report the result
+  * @param tcp: pointer to the TCP connection
+  * @param connected: 1 if established, 0 if failed
+  * @retval None
+  */
+static void tcp_connect_done(struct tcp_struct *tcp, uint8_t connected)
+{
+  void (*callback)(void *arg, uint8_t connected) = tcp->on_connect;
+
+  sys_untimeout(tcp_connect_timeout, tcp);
+  tcp->on_connect = NULL;
+  stm32_eth_signal_event();
+  if (callback != NULL) {
+    callback(tcp->on_connect_arg, connected);
+  }
+}
+
+/**
+  * @brief Give up a connection not established within its timeout
+  * @param arg: pointer to the TCP connection
+  * @retval None
+  */
+static void tcp_connect_timeout(void *arg)
+{
+  struct tcp_struct *tcp = (struct tcp_struct *)arg;
+
+  if ((tcp->state == TCP_CONNECTING) && (tcp->pcb != NULL)) {
+    /* the state becomes TCP_CLOSING */
+    tcp_connection_close(tcp->pcb, tcp);
+    tcp_connect_done(tcp, 0);
+  }
+}
+
+/**
+  * @brief Give up the connection if not established within timeout. Must be
+  *        called from the LwIP context.
+  * @param tcp: pointer to the TCP connection
+  * @param timeout: connection timeout in ms
+  * @retval None
+  */
+void tcp_connect_timeout_start(struct tcp_struct *tcp, uint32_t timeout)
+{
+  sys_timeout(timeout, tcp_connect_timeout, tcp);
+}
+
 /**
   * @brief Function called when TCP connection established
   * @param arg: user supplied argument
@@ -885,20 +2606,69 @@ err_t tcp_connected_callback(void *arg, struct tcp_pcb *tpcb, err_t err)
       /* initialize LwIP tcp_err callback function */
       tcp_err(tpcb, tcp_err_callback);
 
+      /* the connection can be used by the application callback */
+      tcp_connect_done(tcp_arg, 1);
       return ERR_OK;
     } else {
       /* close connection */
-      tcp_connection_close(tpcb, tcp_arg);
-
+      if (tcp_connection_close(tpcb, tcp_arg) == ERR_ABRT) {
+        return ERR_ABRT;
+      }
       return ERR_ARG;
     }
   } else {
     /* close connection */
-    tcp_connection_close(tpcb, tcp_arg);
+    if (tcp_connection_close(tpcb, tcp_arg) == ERR_ABRT) {
+      return ERR_ABRT;
+    }
   }
   return err;
 }
 
+/**
+  * @brief Initialize the structure of a new TCP connection
+  * @param tcp pointer to the TCP connection
+  * @param tpcb connection control block
+  * @param state initial connection state
+  * @retval None
+  */
+void tcp_struct_init(struct tcp_struct *tcp, struct tcp_pcb *tpcb, tcp_client_states state)
+{
+  tcp->pcb = tpcb;
+  tcp->state = state;
+  tcp->data.p = NULL;
+  tcp->data.available = 0;
+  tcp->data.offset = 0;
+  tcp->line_lent = 0;
+  tcp->tx_queued = 0;
+  tcp->tx_acked = 0;
+  tcp->tx_ref_end = 0;
+  tcp->writable = NULL;
+  tcp->writable_arg = NULL;
+  tcp->on_connect = NULL;
+  tcp->on_connect_arg = NULL;
+  tcp->write_blocking = 1;
+  /* The first data read do not reopen the window */
+  tcp->rx_withheld = TCP_WND - ETH_TCP_RX_CAP;
+  tcp->rx_pbufs = 0;
+  tcp->rx_spares = 0;
+  tcp->server = NULL;
+  tcp->clients = NULL;
+}
+
+/**
+  * @brief Release the received data not read by the application
+  * @param tcp pointer to the TCP connection
+  * @retval None
+  */
+void tcp_struct_free_data(struct tcp_struct *tcp)
+{
+  tcp->data.p = stm32_free_data(tcp->data.p);
+  tcp->data.available = 0;
+  tcp->data.offset = 0;
+  tcp_rx_quota_update(tcp);
+}
+
 /**
   * @brief  This function is the implementation of tcp_accept LwIP callback
   * @param arg user supplied argument
@@ -910,7 +2680,8 @@ err_t tcp_accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
   err_t ret_err;
   uint8_t accepted;
-  struct tcp_struct **tcpClient = (struct tcp_struct **)arg;
+  struct tcp_struct *server = (struct tcp_struct *)arg;
+  struct tcp_struct **tcpClient = (server != NULL) ? server->clients : NULL;
 
   /* set priority for the newly accepted tcp connection newpcb */
   tcp_setprio(newpcb, TCP_PRIO_MIN);
@@ -919,10 +2690,8 @@ err_t tcp_accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
     struct tcp_struct *client = (struct tcp_struct *)mem_malloc(sizeof(struct tcp_struct));
 
     if (client != NULL) {
-      client->state = TCP_ACCEPTED;
-      client->pcb = newpcb;
-      client->data.p = NULL;
-      client->data.available = 0;
+      tcp_struct_init(client, newpcb, TCP_ACCEPTED);
+      client->server = server;
 
       /* Looking for an empty socket */
       for (uint16_t i = 0; i < MAX_CLIENT; i++) {
@@ -949,19 +2718,23 @@ err_t tcp_accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err)
         ret_err = ERR_OK;
       } else {
         /*  close tcp connection */
-        tcp_connection_close(newpcb, client);
+        ret_err = tcp_connection_close(newpcb, client);
         mem_free(client);
 
-        /* return memory error */
-        ret_err = ERR_MEM;
+        /* return memory error, unless newpcb was aborted */
+        if (ret_err != ERR_ABRT) {
+          ret_err = ERR_MEM;
+        }
       }
     } else {
       /*  close tcp connection */
-      tcp_connection_close(newpcb, client);
+      ret_err = tcp_connection_close(newpcb, client);
       mem_free(client);
 
-      /* return memory error */
-      ret_err = ERR_MEM;
+      /* return memory error, unless newpcb was aborted */
+      if (ret_err != ERR_ABRT) {
+        ret_err = ERR_MEM;
+      }
     }
   } else {
     tcp_close(newpcb);
@@ -984,9 +2757,9 @@ static err_t tcp_recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p,
 
   /* if we receive an empty tcp frame from server => close connection */
   if (p == NULL) {
-    /* we're done sending, close connection */
-    tcp_connection_close(tpcb, tcp_arg);
-    ret_err = ERR_OK;
+    /* we're done sending, close connection. LwIP must not use tpcb
+       anymore if it was aborted */
+    ret_err = tcp_connection_close(tpcb, tcp_arg);
   }
   /* else : a non empty frame was received from echo server but for some reason err != ERR_OK */
   else if (err != ERR_OK) {
@@ -996,16 +2769,28 @@ static err_t tcp_recv_callback(void *arg, struct tcp_pcb *tpcb, struct pbuf *p,
     }
     ret_err = err;
   } else if ((tcp_arg->state == TCP_CONNECTED) || (tcp_arg->state == TCP_ACCEPTED)) {
-    /* Acknowledge data reception */
-    tcp_recved(tpcb, p->tot_len);
+#ifdef ETH_RX_ZERO_COPY
+    p = tcp_rx_spare_limit(tcp_arg, p);
+#endif
+#if ETH_RX_COMPACT_SIZE > 0
+    p = tcp_rx_compact(p);
+#endif
+    if (!tcp_rx_quota_take(tcp_arg, tcp_rx_clen(p))) {
+      /* LwIP keeps p and delivers it again later */
+      return ERR_MEM;
+    }
+    tcp_arg->rx_spares += tcp_rx_spares(p);
+    gEthRxQuotaStats.spares_held += tcp_rx_spares(p);
 
+    /* Data reception is acknowledged when the application reads it */
     if (tcp_arg->data.p == NULL) {
       tcp_arg->data.p = p;
     } else {
       pbuf_chain(tcp_arg->data.p, p);
     }
 
-    tcp_arg->data.available += p->len;
+    tcp_arg->data.available += p->tot_len;
+    stm32_eth_signal_event();
     ret_err = ERR_OK;
   }
   /* data received when connection already closed */
@@ -1032,9 +2817,13 @@ static err_t tcp_sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len)
 {
   struct tcp_struct *tcp_arg = (struct tcp_struct *)arg;
 
-  LWIP_UNUSED_ARG(len);
-
   if ((tcp_arg != NULL) && (tcp_arg->pcb == tpcb)) {
+    tcp_arg->tx_acked += len;
+    /* Send buffer space freed: wake up the writers */
+    if (tcp_arg->writable != NULL) {
+      tcp_arg->writable(tcp_arg->writable_arg);
+    }
+    stm32_eth_signal_event();
     return ERR_OK;
   }
 
@@ -1051,26 +2840,78 @@ static err_t tcp_sent_callback(void *arg, struct tcp_pcb *tpcb, u16_t len)
  *            ERR_ABRT: aborted through tcp_abort or by a TCP timer
  *            ERR_RST: the connection was reset by the remote host
  */
-static void tcp_err_callback(void *arg, err_t err)
+void tcp_err_callback(void *arg, err_t err)
 {
   struct tcp_struct *tcp_arg = (struct tcp_struct *)arg;
 
   if (tcp_arg != NULL) {
     if (ERR_OK != err) {
       tcp_arg->pcb = NULL;
-      tcp_arg->state = TCP_CLOSING;
+      if (tcp_arg->state == TCP_CONNECTING) {
+        tcp_arg->state = TCP_CLOSING;
+        tcp_connect_done(tcp_arg, 0);
+      } else {
+        tcp_arg->state = TCP_CLOSING;
+        stm32_eth_signal_event();
+      }
     }
   }
 }
 
+#if ETH_TCP_WRITE_LINGER > 0
 /**
-  * @brief This function is used to close the tcp connection with server
-  * @param tpcb: tcp connection control block
-  * @param es: pointer on echoclient structure
+  * @brief Send the data queued on all TCP connections
+  * @param arg: unused
   * @retval None
   */
-void tcp_connection_close(struct tcp_pcb *tpcb, struct tcp_struct *tcp)
+static void tcp_linger_timeout(void *arg)
+{
+  struct tcp_pcb *pcb;
+
+  UNUSED(arg);
+  gEthTcpLingerArmed = 0;
+  for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+    if (pcb->unsent != NULL) {
+      tcp_output(pcb);
+    }
+  }
+}
+#endif /* ETH_TCP_WRITE_LINGER > 0 */
+
+/**
+  * @brief Send the data queued by tcp_write() with TCP_WRITE_FLAG_MORE within
+  *        ETH_TCP_WRITE_LINGER ms, so that following writes fill the same
+  *        segment. Must be called from the LwIP context.
+  * @param tpcb: tcp connection control block
+  * @retval ERR_OK, or the tcp_output() error if ETH_TCP_WRITE_LINGER is 0
+  */
+err_t tcp_output_deferred(struct tcp_pcb *tpcb)
+{
+#if ETH_TCP_WRITE_LINGER > 0
+  UNUSED(tpcb);
+  if (!gEthTcpLingerArmed) {
+    gEthTcpLingerArmed = 1;
+    sys_timeout(ETH_TCP_WRITE_LINGER, tcp_linger_timeout, NULL);
+  }
+  return ERR_OK;
+#else
+  return tcp_output(tpcb);
+#endif
+}
+
+/**
+  * @brief This function is used to close the tcp connection with server.
+  * The connection is aborted if data written by reference is not acknowledged
+  * yet, LwIP would otherwise keep sending it from the application buffer.
+  * @param tpcb: tcp connection control block
+  * @param es: pointer on echoclient structure, may be NULL
+  * @retval ERR_ABRT if the pcb was aborted: a LwIP callback must then return
+  *         ERR_ABRT, ERR_OK otherwise
+  */
+err_t tcp_connection_close(struct tcp_pcb *tpcb, struct tcp_struct *tcp)
 {
+  err_t err = ERR_OK;
+
   /* remove callbacks */
   tcp_recv(tpcb, NULL);
   tcp_sent(tpcb, NULL);
@@ -1078,13 +2919,39 @@ void tcp_connection_close(struct tcp_pcb *tpcb, struct tcp_struct *tcp)
   tcp_err(tpcb, NULL);
   tcp_accept(tpcb, NULL);
 
+  if (tcp != NULL) {
+    /* no callback for a connection attempt given up by the application */
+    sys_untimeout(tcp_connect_timeout, tcp);
+  }
+
+  if (tpcb->state != LISTEN) {
+    /* Acknowledge the data refused, not read or withheld by ETH_TCP_RX_CAP:
+       with a window not fully open, tcp_close() resets the connection and
+       drops the data not sent yet */
+    if (tpcb->refused_data != NULL) {
+      pbuf_free(tpcb->refused_data);
+      tpcb->refused_data = NULL;
+    }
+    while (tpcb->rcv_wnd < TCP_WND_MAX(tpcb)) {
+      tcp_recved(tpcb, ((TCP_WND_MAX(tpcb) - tpcb->rcv_wnd) > 0xFFFFU) ?
+                 0xFFFFU : (u16_t)(TCP_WND_MAX(tpcb) - tpcb->rcv_wnd));
+    }
+  }
+
   /* close tcp connection */
-  if (tcp_close(tpcb) != ERR_OK) {
+  if ((tcp != NULL) && ((int32_t)(tcp->tx_ref_end - tcp->tx_acked) > 0)) {
+    tcp_abort(tpcb);
+    err = ERR_ABRT;
+  } else if (tcp_close(tpcb) != ERR_OK) {
     tcp_abort(tpcb);
+    err = ERR_ABRT;
   }
 
-  tcp->pcb = NULL;
-  tcp->state = TCP_CLOSING;
+  if (tcp != NULL) {
+    tcp->pcb = NULL;
+    tcp->state = TCP_CLOSING;
+  }
+  return err;
 }
 
 #endif /* LWIP_TCP */
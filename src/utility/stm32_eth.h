@@ -56,12 +56,14 @@ typedef enum {
   TCP_SENT,
   TCP_ACCEPTED,
   TCP_CLOSING,
+  TCP_CONNECTING,
 } tcp_client_states;
 
 /* Struct to store received data */
 struct pbuf_data {
   struct pbuf *p;     // the packet buffer that was received
-  uint16_t available; // number of data
+  uint32_t available; // number of data
+  uint16_t offset;    // number of data already read in p
 };
 
 /* UDP structure */
@@ -78,6 +80,63 @@ struct tcp_struct {
   struct tcp_pcb *pcb;          /* pointer on the current tcp_pcb */
   struct pbuf_data data;
   tcp_client_states state;      /* current connection state */
+  uint32_t tx_queued;           /* bytes queued for sending since connection */
+  uint32_t tx_acked;            /* bytes acknowledged by the remote since connection */
+  uint32_t tx_ref_end;          /* tx_queued after the last data written by reference */
+  void (*writable)(void *arg);  /* called when send buffer space is freed, from the LwIP context */
+  void *writable_arg;           /* argument of writable */
+  void (*on_connect)(void *arg, uint8_t connected); /* called when a connection started by EthernetClient::connectAsync() succeeds or fails */
+  void *on_connect_arg;         /* argument of on_connect */
+  uint8_t write_blocking;       /* write() waits for send buffer space, see EthernetClient::setWriteBlocking() */
+  uint32_t line_lent;           /* bytes of the line returned by EthernetClient::readLine(), not consumed yet */
+  uint32_t rx_withheld;         /* receive window kept closed to apply ETH_TCP_RX_CAP */
+  uint16_t rx_pbufs;            /* received pbufs held in data, for a server by all its clients */
+  uint16_t rx_spares;           /* zero-copy receive buffers held in data, see ETH_TCP_RX_SPARE_QUOTA */
+  struct tcp_struct *server;    /* server of an accepted connection, NULL otherwise */
+  struct tcp_struct **clients;  /* clients of a server, MAX_CLIENT entries */
+};
+
+/* Received pbufs held by the TCP connections, see ETH_TCP_RX_PBUF_QUOTA */
+struct stm32_eth_rx_quota_stats {
+  uint16_t held;                /* pbufs currently held */
+  uint16_t held_max;            /* highest number of pbufs held */
+  uint32_t conn_quota_hits;     /* segments refused, connection quota reached */
+  uint32_t server_quota_hits;   /* segments refused, server quota reached */
+  uint32_t reserve_hits;        /* segments refused, pool reserve reached */
+  uint32_t compacted;           /* small segments copied to the heap, see ETH_RX_COMPACT_SIZE */
+  uint16_t spares_held;         /* zero-copy receive buffers currently held, see ETH_RX_ZERO_COPY */
+  uint32_t spares_copied;       /* segments copied to pool pbufs, ETH_TCP_RX_SPARE_QUOTA reached */
+};
+
+/* Scheduler phases timed with ETH_SCHEDULER_STATS */
+enum stm32_eth_sched_phase {
+  ETH_PHASE_API = 0,    /* LwIP calls queued by the application */
+  ETH_PHASE_INPUT,      /* ethernetif_input() */
+  ETH_PHASE_TX,         /* ethernetif_tx_process() */
+  ETH_PHASE_MDIO,       /* ethernetif_mdio_process() */
+  ETH_PHASE_LINK,       /* link status check */
+  ETH_PHASE_TIMEOUTS,   /* sys_check_timeouts() */
+  ETH_PHASE_DHCP,       /* stm32_DHCP_Periodic_Handle() */
+  ETH_PHASE_TOTAL,      /* whole scheduler run, frame processing only with ETH_HOUSEKEEPING_TIMER */
+  ETH_PHASE_NB
+};
+
+#define ETH_STATS_HIST_BUCKETS 32U
+
+/* Durations of a scheduler phase, in CPU cycles */
+struct stm32_eth_phase_stats {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t hist[ETH_STATS_HIST_BUCKETS];  /* hist[n]: durations from 2^n to 2^(n+1) - 1 */
+};
+
+/* Scheduler timing statistics */
+struct stm32_eth_timing_stats {
+  struct stm32_eth_phase_stats phase[ETH_PHASE_NB];
+  uint32_t isr_max;         /* longest scheduler timer interrupt, in cycles */
+  uint32_t late_ticks;      /* periodic runs delayed by more than half a period */
+  uint32_t cycles_per_us;   /* CPU cycles per microsecond */
 };
 
 /* Exported constants --------------------------------------------------------*/
@@ -116,13 +175,36 @@ struct tcp_struct {
 #endif
 
 
+/* Function using the LwIP raw API, see stm32_eth_api_call() */
+typedef err_t (*stm32_eth_api_fn)(void *arg);
+
+/* Scheduler statistics */
+struct stm32_eth_scheduler_stats {
+  uint32_t periodic_runs; /* runs on timer period */
+  uint32_t forced_runs;   /* runs brought forward by stm32_eth_scheduler() */
+  uint32_t kicks;         /* stm32_eth_scheduler() calls */
+  uint32_t kicks_idle;    /* calls ignored, no work pending */
+  uint32_t api_runs;      /* runs of the application calls only, forced by stm32_eth_api_call() */
+};
+
 /* Exported functions ------------------------------------------------------- */
 void stm32_eth_init(const uint8_t *mac, const uint8_t *ip, const uint8_t *gw, const uint8_t *netmask);
 uint8_t stm32_eth_is_init(void);
 void stm32_eth_get_macaddr(uint8_t *mac);
 void stm32_eth_set_macaddr(const uint8_t *mac);
 uint8_t stm32_eth_link_up(void);
+uint16_t stm32_eth_link_speed(void);
+uint8_t stm32_eth_link_full_duplex(void);
 void stm32_eth_scheduler(void);
+const struct stm32_eth_scheduler_stats *stm32_eth_get_scheduler_stats(void);
+const struct stm32_eth_rx_quota_stats *stm32_eth_get_rx_quota_stats(void);
+#ifdef ETH_SCHEDULER_STATS
+  const struct stm32_eth_timing_stats *stm32_eth_get_timing_stats(void);
+  void stm32_eth_reset_timing_stats(void);
+  uint32_t stm32_eth_timing_percentile(uint8_t phase, uint8_t percent);
+#endif
+void stm32_eth_wait_event(uint32_t timeout);
+err_t stm32_eth_api_call(stm32_eth_api_fn fn, void *arg);
 
 void User_notification(struct netif *netif);
 
@@ -160,7 +242,14 @@ uint32_t stm32_eth_get_dhcpaddr(void);
 
 struct pbuf *stm32_new_data(struct pbuf *p, const uint8_t *buffer, size_t size);
 struct pbuf *stm32_free_data(struct pbuf *p);
-uint16_t stm32_get_data(struct pbuf_data *data, uint8_t *buffer, size_t size);
+uint32_t stm32_get_data(struct pbuf_data *data, uint8_t *buffer, size_t size);
+uint32_t stm32_borrow_data(struct pbuf_data *data, uint32_t skip, const uint8_t **span);
+uint32_t stm32_commit_data(struct pbuf_data *data, size_t size);
+uint32_t stm32_tcp_get_data(struct tcp_struct *tcp, uint8_t *buffer, size_t size);
+uint32_t stm32_tcp_commit_data(struct tcp_struct *tcp, size_t size);
+int stm32_peek_data(struct pbuf_data *data, uint32_t skip);
+int32_t stm32_find_data(struct pbuf_data *data, uint8_t c, uint32_t max);
+int8_t stm32_match_data(struct pbuf_data *data, const uint8_t *s, size_t len);
 
 ip_addr_t *u8_to_ip_addr(uint8_t *ipu8, ip_addr_t *ipaddr);
 uint32_t ip_addr_to_u32(ip_addr_t *ipaddr);
@@ -168,7 +257,12 @@ uint32_t ip_addr_to_u32(ip_addr_t *ipaddr);
 #if LWIP_TCP
   err_t tcp_connected_callback(void *arg, struct tcp_pcb *tpcb, err_t err);
   err_t tcp_accept_callback(void *arg, struct tcp_pcb *newpcb, err_t err);
-  void tcp_connection_close(struct tcp_pcb *tpcb, struct tcp_struct *tcp);
+  void tcp_err_callback(void *arg, err_t err);
+  void tcp_struct_init(struct tcp_struct *tcp, struct tcp_pcb *tpcb, tcp_client_states state);
+  void tcp_struct_free_data(struct tcp_struct *tcp);
+  err_t tcp_connection_close(struct tcp_pcb *tpcb, struct tcp_struct *tcp);
+  err_t tcp_output_deferred(struct tcp_pcb *tpcb);
+  void tcp_connect_timeout_start(struct tcp_struct *tcp, uint32_t timeout);
 #else
   #error "LWIP_TCP must be enabled in lwipopts.h"
 #endif
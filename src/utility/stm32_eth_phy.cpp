@@ -0,0 +1,139 @@
+/**
+  ******************************************************************************
+  * @file    stm32_eth_phy.cpp
+  * @brief   Ethernet PHY drivers description
+  *          Each supported PHY is described by the registers giving the link
+  *          state, the negotiated mode and the link change interrupt. PHYs
+  *          not listed are handled with the IEEE 802.3 clause 22 registers.
+  ******************************************************************************
+  * @attention
+  *
+  * <h2><center>&copy; COPYRIGHT(c) 2026 STMicroelectronics</center></h2>
+  *
+  * Redistribution and use in source and binary forms, with or without modification,
+  * are permitted provided that the following conditions are met:
+  *   1. Redistributions of source code must retain the above copyright notice,
+  *      this list of conditions and the following disclaimer.
+  *   2. Redistributions in binary form must reproduce the above copyright notice,
+  *      this list of conditions and the following disclaimer in the documentation
+  *      and/or other materials provided with the distribution.
+  *   3. Neither the name of STMicroelectronics nor the names of its contributors
+  *      may be used to endorse or promote products derived from this software
+  *      without specific prior written permission.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32_eth_phy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Private define ------------------------------------------------------------*/
+/* Clause 22 basic status register: auto-negotiation complete */
+#define PHY_BSR_AN_COMPLETE       ((uint16_t)0x0020)
+
+/* Clause 22 auto-negotiation abilities */
+#define PHY_AN_100BASE_TX_FD      ((uint16_t)0x0100)
+#define PHY_AN_100BASE_TX         ((uint16_t)0x0080)
+#define PHY_AN_10BASE_T_FD        ((uint16_t)0x0040)
+
+/* Private variables ---------------------------------------------------------*/
+/* Supported PHYs, the last entry matches any PHY */
+static const struct stm32_eth_phy_driver phy_drivers[] = {
+  {
+    /* Special control/status register 31, interrupt source/mask registers 29/30:
+       link down (INT4) and auto-negotiation complete (INT6) */
+    "LAN8742", 0x0007C130, 0xFFFFFFF0,
+    0x1F, 0x1000, 0x1F, 0, 0x0004, 0x0010,
+    0x1D, 0x0050, {0x1E, 0}, {0x0050, 0}
+  },
+  {
+    /* PHY status register 16, interrupt control/status registers 17/18:
+       link status change and auto-negotiation complete, interrupt output enabled */
+    "DP83848", 0x20005C90, 0xFFFFFFF0,
+    0x10, 0x0010, 0x10, 0, 0x0002, 0x0004,
+    0x12, 0x2400, {0x11, 0x12}, {0x0003, 0x0024}
+  },
+  {
+    /* PHY control 1 register 30 operation mode, interrupt control/status
+       register 27: link down and link up */
+    "KSZ8081", 0x00221560, 0xFFFFFFF0,
+    0x01, PHY_BSR_AN_COMPLETE, 0x1E, 0, 0x0001, 0x0004,
+    0x1B, 0x0005, {0x1B, 0}, {0x0500, 0}
+  },
+  {
+    /* IEEE 802.3 clause 22: mode resolved from the advertised abilities, no interrupt */
+    "Generic", 0, 0,
+    0x01, PHY_BSR_AN_COMPLETE, ETH_PHY_REG_ANAR, ETH_PHY_REG_ANLPAR, 0, 0,
+    0, 0, {0, 0}, {0, 0}
+  }
+};
+
+/* Exported functions --------------------------------------------------------*/
+/**
+  * @brief  Find the driver of a PHY
+  * @param  id: PHY identifier (IDR1 << 16 | IDR2)
+  * @retval PHY driver, the generic one if the PHY is unknown
+  */
+const struct stm32_eth_phy_driver *stm32_eth_phy_find(uint32_t id)
+{
+  uint32_t i;
+
+  for (i = 0; i < (sizeof(phy_drivers) / sizeof(phy_drivers[0])) - 1; i++) {
+    if ((id & phy_drivers[i].id_mask) == phy_drivers[i].id) {
+      break;
+    }
+  }
+  return &phy_drivers[i];
+}
+
+/**
+  * @brief  Get the negotiated link mode
+  * @param  phy: PHY driver
+  * @param  status: value of the status_reg register
+  * @param  lpa: value of the lpa_reg register, if any
+  * @param  speed: set to 10 or 100 (Mb/s)
+  * @param  full_duplex: set to 1 for full duplex, else 0
+  * @retval None
+  */
+void stm32_eth_phy_get_mode(const struct stm32_eth_phy_driver *phy, uint16_t status, uint16_t lpa,
+                            uint16_t *speed, uint8_t *full_duplex)
+{
+  uint16_t common;
+
+  if (phy->lpa_reg != 0) {
+    /* Highest ability shared with the link partner */
+    common = status & lpa;
+    if (common & PHY_AN_100BASE_TX_FD) {
+      *speed = 100;
+      *full_duplex = 1;
+    } else if (common & PHY_AN_100BASE_TX) {
+      *speed = 100;
+      *full_duplex = 0;
+    } else {
+      *speed = 10;
+      *full_duplex = (common & PHY_AN_10BASE_T_FD) ? 1 : 0;
+    }
+  } else {
+    *speed = (status & phy->speed_10M) ? 10 : 100;
+    *full_duplex = (status & phy->full_duplex) ? 1 : 0;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
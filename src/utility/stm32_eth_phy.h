@@ -0,0 +1,82 @@
+/**
+  ******************************************************************************
+  * @file    stm32_eth_phy.h
+  * @brief   Ethernet PHY drivers description
+  ******************************************************************************
+  * @attention
+  *
+  * <h2><center>&copy; COPYRIGHT(c) 2026 STMicroelectronics</center></h2>
+  *
+  * Redistribution and use in source and binary forms, with or without modification,
+  * are permitted provided that the following conditions are met:
+  *   1. Redistributions of source code must retain the above copyright notice,
+  *      this list of conditions and the following disclaimer.
+  *   2. Redistributions in binary form must reproduce the above copyright notice,
+  *      this list of conditions and the following disclaimer in the documentation
+  *      and/or other materials provided with the distribution.
+  *   3. Neither the name of STMicroelectronics nor the names of its contributors
+  *      may be used to endorse or promote products derived from this software
+  *      without specific prior written permission.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  ******************************************************************************
+  */
+
+#ifndef __STM32_ETH_PHY_H__
+#define __STM32_ETH_PHY_H__
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Exported constants --------------------------------------------------------*/
+/* IEEE 802.3 clause 22 registers not defined by the HAL configuration */
+#define ETH_PHY_REG_IDR1          ((uint16_t)0x02)  /* PHY identifier 1 */
+#define ETH_PHY_REG_IDR2          ((uint16_t)0x03)  /* PHY identifier 2 */
+#define ETH_PHY_REG_ANAR          ((uint16_t)0x04)  /* Auto-negotiation advertisement */
+#define ETH_PHY_REG_ANLPAR        ((uint16_t)0x05)  /* Auto-negotiation link partner ability */
+
+/* Number of registers written to enable the PHY link interrupt */
+#define ETH_PHY_INT_CTRL_NB       2U
+
+/* Exported types ------------------------------------------------------------*/
+/* PHY description: registers and bits used to get the link state */
+struct stm32_eth_phy_driver {
+  const char *name;                             /* PHY name */
+  uint32_t id;                                  /* identifier (IDR1 << 16 | IDR2) */
+  uint32_t id_mask;                             /* identifier bits compared, 0 matches any PHY */
+  uint16_t an_reg;                              /* register holding the auto-negotiation done bit */
+  uint16_t an_done;                             /* auto-negotiation done bit */
+  uint16_t status_reg;                          /* register giving the negotiated mode */
+  uint16_t lpa_reg;                             /* link partner abilities, 0 if status_reg is enough */
+  uint16_t speed_10M;                           /* 10 Mb/s bit in status_reg (vendor registers) */
+  uint16_t full_duplex;                         /* full duplex bit in status_reg (vendor registers) */
+  uint16_t int_status_reg;                      /* interrupt status register cleared on read, 0 if none */
+  uint16_t int_link;                            /* link change events in int_status_reg */
+  uint16_t int_ctrl_reg[ETH_PHY_INT_CTRL_NB];   /* registers enabling the link interrupt, 0 if unused */
+  uint16_t int_ctrl_val[ETH_PHY_INT_CTRL_NB];   /* bits set in int_ctrl_reg */
+};
+
+/* Exported functions ------------------------------------------------------- */
+const struct stm32_eth_phy_driver *stm32_eth_phy_find(uint32_t id);
+void stm32_eth_phy_get_mode(const struct stm32_eth_phy_driver *phy, uint16_t status, uint16_t lpa,
+                            uint16_t *speed, uint8_t *full_duplex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32_ETH_PHY_H__ */
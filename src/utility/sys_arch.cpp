@@ -0,0 +1,222 @@
+/**
+  ******************************************************************************
+  * @file    sys_arch.cpp
+  * @brief   LwIP operating system emulation layer: critical sections, and
+  *          FreeRTOS port when NO_SYS is 0
+  ******************************************************************************
+  * @attention
+  *
+  * <h2><center>&copy; COPYRIGHT(c) 2026 STMicroelectronics</center></h2>
+  *
+  * Redistribution and use in source and binary forms, with or without modification,
+  * are permitted provided that the following conditions are met:
+  *   1. Redistributions of source code must retain the above copyright notice,
+  *      this list of conditions and the following disclaimer.
+  *   2. Redistributions in binary form must reproduce the above copyright notice,
+  *      this list of conditions and the following disclaimer in the documentation
+  *      and/or other materials provided with the distribution.
+  *   3. Neither the name of STMicroelectronics nor the names of its contributors
+  *      may be used to endorse or promote products derived from this software
+  *      without specific prior written permission.
+  *
+  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  ******************************************************************************
+  */
+
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32_def.h"
+#include "lwip/opt.h"
+#include "lwip/sys.h"
+
+#if SYS_LIGHTWEIGHT_PROT
+/*--------------------------- Critical sections ------------------------------*/
+/* Short sections, also used from interrupts: mask all interrupts */
+sys_prot_t sys_arch_protect(void)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  return (sys_prot_t)primask;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+  __set_PRIMASK((uint32_t)pval);
+}
+#endif /* SYS_LIGHTWEIGHT_PROT */
+
+#if !NO_SYS
+
+/* Private define ------------------------------------------------------------*/
+/* Convert a LwIP timeout in ms (0 waits forever) to FreeRTOS ticks */
+#define SYS_ARCH_TICKS(ms)  (((ms) == 0) ? portMAX_DELAY : \
+                             ((pdMS_TO_TICKS(ms) > 0) ? pdMS_TO_TICKS(ms) : 1))
+
+/**
+  * @brief  Initialize the emulation layer
+  * @param  None
+  * @retval None
+  */
+void sys_init(void)
+{
+}
+
+/*------------------------------- Semaphores ---------------------------------*/
+err_t sys_sem_new(sys_sem_t *sem, u8_t count)
+{
+  *sem = xSemaphoreCreateBinary();
+  if (*sem == NULL) {
+    return ERR_MEM;
+  }
+  if (count > 0) {
+    xSemaphoreGive(*sem);
+  }
+  return ERR_OK;
+}
+
+void sys_sem_signal(sys_sem_t *sem)
+{
+  xSemaphoreGive(*sem);
+}
+
+/**
+  * @brief  Wait for a semaphore
+  * @param  sem: semaphore to wait for
+  * @param  timeout: maximum time to wait in ms, 0 waits forever
+  * @retval time waited in ms or SYS_ARCH_TIMEOUT
+  */
+u32_t sys_arch_sem_wait(sys_sem_t *sem, u32_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+
+  if (xSemaphoreTake(*sem, SYS_ARCH_TICKS(timeout)) != pdTRUE) {
+    return SYS_ARCH_TIMEOUT;
+  }
+  return (u32_t)((xTaskGetTickCount() - start) * portTICK_PERIOD_MS);
+}
+
+void sys_sem_free(sys_sem_t *sem)
+{
+  vSemaphoreDelete(*sem);
+  *sem = NULL;
+}
+
+/*-------------------------------- Mutexes -----------------------------------*/
+/* Recursive, so that a LwIP callback can call the API again with the core locked */
+err_t sys_mutex_new(sys_mutex_t *mutex)
+{
+  *mutex = xSemaphoreCreateRecursiveMutex();
+  return (*mutex == NULL) ? ERR_MEM : ERR_OK;
+}
+
+void sys_mutex_lock(sys_mutex_t *mutex)
+{
+  xSemaphoreTakeRecursive(*mutex, portMAX_DELAY);
+}
+
+void sys_mutex_unlock(sys_mutex_t *mutex)
+{
+  xSemaphoreGiveRecursive(*mutex);
+}
+
+void sys_mutex_free(sys_mutex_t *mutex)
+{
+  vSemaphoreDelete(*mutex);
+  *mutex = NULL;
+}
+
+/*------------------------------- Mailboxes ----------------------------------*/
+err_t sys_mbox_new(sys_mbox_t *mbox, int size)
+{
+  *mbox = xQueueCreate((UBaseType_t)size, sizeof(void *));
+  return (*mbox == NULL) ? ERR_MEM : ERR_OK;
+}
+
+void sys_mbox_post(sys_mbox_t *mbox, void *msg)
+{
+  xQueueSendToBack(*mbox, &msg, portMAX_DELAY);
+}
+
+err_t sys_mbox_trypost(sys_mbox_t *mbox, void *msg)
+{
+  return (xQueueSendToBack(*mbox, &msg, 0) == pdTRUE) ? ERR_OK : ERR_MEM;
+}
+
+err_t sys_mbox_trypost_fromisr(sys_mbox_t *mbox, void *msg)
+{
+  BaseType_t woken = pdFALSE;
+
+  if (xQueueSendToBackFromISR(*mbox, &msg, &woken) != pdTRUE) {
+    return ERR_MEM;
+  }
+  portYIELD_FROM_ISR(woken);
+  return ERR_OK;
+}
+
+/**
+  * @brief  Wait for a message
+  * @param  mbox: mailbox to fetch from
+  * @param  msg: where to store the message, can be NULL
+  * @param  timeout: maximum time to wait in ms, 0 waits forever
+  * @retval time waited in ms or SYS_ARCH_TIMEOUT
+  */
+u32_t sys_arch_mbox_fetch(sys_mbox_t *mbox, void **msg, u32_t timeout)
+{
+  TickType_t start = xTaskGetTickCount();
+  void *dummy;
+
+  if (xQueueReceive(*mbox, (msg != NULL) ? msg : &dummy, SYS_ARCH_TICKS(timeout)) != pdTRUE) {
+    if (msg != NULL) {
+      *msg = NULL;
+    }
+    return SYS_ARCH_TIMEOUT;
+  }
+  return (u32_t)((xTaskGetTickCount() - start) * portTICK_PERIOD_MS);
+}
+
+u32_t sys_arch_mbox_tryfetch(sys_mbox_t *mbox, void **msg)
+{
+  void *dummy;
+
+  if (xQueueReceive(*mbox, (msg != NULL) ? msg : &dummy, 0) != pdTRUE) {
+    return SYS_MBOX_EMPTY;
+  }
+  return 0;
+}
+
+void sys_mbox_free(sys_mbox_t *mbox)
+{
+  vQueueDelete(*mbox);
+  *mbox = NULL;
+}
+
+/*-------------------------------- Threads -----------------------------------*/
+/**
+  * @brief  Create a thread
+  * @param  name: thread name
+  * @param  thread: thread function
+  * @param  arg: argument passed to the thread function
+  * @param  stacksize: stack size in words
+  * @param  prio: FreeRTOS priority
+  * @retval thread handle
+  */
+sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg, int stacksize, int prio)
+{
+  TaskHandle_t handle = NULL;
+
+  xTaskCreate(thread, name, (configSTACK_DEPTH_TYPE)stacksize, arg, (UBaseType_t)prio, &handle);
+  return handle;
+}
+
+#endif /* !NO_SYS */